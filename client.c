@@ -1,6 +1,7 @@
 #include "includes.h"
 #include <termios.h>
 #include <unistd.h>
+#include <poll.h>
 
 // Check if the write command format is correct
 bool correctWriteMode(char* write_mode) {    
@@ -9,13 +10,52 @@ bool correctWriteMode(char* write_mode) {
     return true;
 }
 
+// Check if the response is an event pushed for a watched file
+bool isWatchEvent(Response *res) {
+    return !strncmp(res->status, "Watch event", strlen("Watch event"));
+}
+
+// Output a watch event (ex: file1,120,2024/12/08 09:31,3)
+void print_watch_event(Response *res) {
+    printf("\n[Watch  ]: %s (%s)\n", res->status + strlen("Watch event: "), res->content);
+}
+
+// Receive the response of a request, watch events that arrive first are printed
+int recv_response(int sock_fd, Response *res) {
+    int read_size;
+    while ((read_size = recv(sock_fd, res, sizeof(Response), MSG_WAITALL)) > 0 && isWatchEvent(res)) 
+        print_watch_event(res);
+    return read_size;
+}
+
+// Wait for user input, print watch events pushed by the server meanwhile
+bool wait_for_input(int sock_fd, User *user) {
+    struct pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {sock_fd, POLLIN, 0}};
+
+    while (poll(fds, 2, -1) >= 0) {
+        if (fds[0].revents) return true;
+
+        if (fds[1].revents) {
+            Response res;
+            if (recv(sock_fd, &res, sizeof(Response), MSG_WAITALL) <= 0) {
+                printf("\nDisconnected from server.\n");
+                return false;
+            }
+            print_watch_event(&res);
+            printf("%s > ", user->name);
+            fflush(stdout);
+        }
+    }
+    return false;
+}
+
 // Output server response
 void print_server_response(int sock_fd) {
     Response res;
     int read_size;
 
     // Receive response from the server
-    if ((read_size = recv(sock_fd, &res, sizeof(Response), 0)) > 0) {
+    if ((read_size = recv_response(sock_fd, &res)) > 0) {
         printf("[Server ]: %s\n", res.status);
         if (strlen(res.content) > 0) 
             printf("[Content]:\n%s\n", res.content);
@@ -42,7 +82,7 @@ void handle_write(User* user, int user_fd, const char *command) {
 
     // Receive server response
     Response res;
-    if (recv(user_fd, &res, sizeof(Response), 0) > 0) {
+    if (recv_response(user_fd, &res) > 0) {
 
         // Output server response
         printf("[Server ]: %s\n", res.status);
@@ -104,6 +144,7 @@ void handle_client(int user_fd, User *user) {
         printf("%s > ", user->name);
         fflush(stdout);
 
+        if (!wait_for_input(user_fd, user)) break;
         if (fgets(command, sizeof(command), stdin) == NULL) {
             printf("Error reading input. Exiting.\n");
             break;
@@ -122,7 +163,12 @@ void handle_client(int user_fd, User *user) {
             printf(" create [filename] [permissions]:\tcreate a file. (permissions ex: r-rw--).\n");
             printf(" mode   [filename] [permissions]:\tchange the permission of the file.\n");
             printf(" write  [filename] [mode]:\t\twrite a file. mode o/a means overwrite/append.\n");
-            printf(" read   [filename]:\t\t\tget the content of the file.\n");
+            printf(" read   [filename] (verify):\t\tget the content of the file, optionally check its checksum.\n");
+            printf(" delete [filename]:\t\t\tdelete the file. (owner only)\n");
+            printf(" rename [filename] [new filename]:\trename the file. (owner only)\n");
+            printf(" truncate [filename] [size]:\t\tcut the file to the size in bytes.\n");
+            printf(" watch  [filename]:\t\t\tget notified when the file changes.\n");
+            printf(" unwatch [filename]:\t\t\tstop the notifications of the file.\n");
             printf(" ls:  \t\t\t\t\tlist all the files that can be read/written.\n");
             printf("=====================================================================================\n\n");
         }
@@ -138,7 +184,7 @@ void handle_client(int user_fd, User *user) {
 
             // Receive server response
             Response res;
-            if (recv(user_fd, &res, sizeof(Response), 0) > 0) {
+            if (recv_response(user_fd, &res) > 0) {
                 if(!strcmp(res.status, "List accessible files successful")){
                     char *token, *filename, *permissions;
 
@@ -193,6 +239,7 @@ int main() {
     struct sockaddr_in server_addr;
 
     char username[256], userGroup[50];
+    setvbuf(stdin, NULL, _IONBF, 0);    // no hidden stdin buffer, poll() must see every pending input
     printf("Please input your name: ");     scanf("%s", username);
     printf("Please input your group: ");    scanf("%s", userGroup);
 
@@ -3,12 +3,44 @@
 #include <semaphore.h>
 #include <time.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <stdatomic.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 
 #define MAX_CLIENTS   15    // Maximum client connection count
+#define LISTEN_BACKLOG 128  // Connections the kernel queues, also while a hot restart drains the old server
 #define MAX_FD 200          // Maximum FD value
 #define MAX_FILES_NUM 100   // Maximum number of files
+#define MAX_WATCHERS 16     // Maximum connections watching one file
+#define WATCH_PUSH_WAIT_MS 10   // How long an event waits for a busy connection before the watcher is dropped
 #define PERMISSION_LEN 6    // Permission length
 #define FILE_DIRECTORY "./files"    // File storage path
+#define TRASH_DIRECTORY "./files/.trash"    // Deleted files waiting for the reclaimer
+#define MMAP_THRESHOLD (64 * 1024)  // Files at least this large are read through mmap
+#define LOG_DIRECTORY "./logs"      // Audit log segments
+#define LOG_SEGMENT_RECORDS 4096    // Records per log segment
+#define LOG_TAIL_DEFAULT 20         // Records shown by the admin "log" command
+#define MAX_IDENTITIES 128          // Users and groups tracked for quotas
+#define MAX_RATE_LIMIT 1000000      // Highest request rate that can be configured
+#define RATE_BURST_SECONDS 2        // Token bucket holds this many seconds of requests
+#define QUOTA_CONFIG "quota.conf"   // Quota settings read at startup
+#define SCRUB_INTERVAL 600          // Seconds before a file is verified again in the background
+#define SCRUB_CHUNK (256 * 1024)    // Bytes the scrubber reads at a time
+#define CHECKSUM_CHUNK (64 * 1024)  // Bytes file_checksum reads at a time
+#define SCRUB_PAUSE_MS 10           // Pause after each chunk (caps the scrubber at ~25MB/s)
+#define SCRUB_IDLE_MS 500           // Scrubber waits until no request came in for this long
+#define SHUTDOWN_DEADLINE 10        // Seconds in-flight requests get to finish on shutdown
+#define CATALOG_FILE "./catalog.dat"        // File list saved on shutdown, loaded on start
+#define HANDOFF_SOCKET "./server.handoff"   // Unix socket passing the listener on hot restart
+#define HANDOFF_TIMEOUT 5           // Seconds to wait for the new server on hot restart
+#define BENCH_ROUNDS 2000           // Reads per file size in the admin benchmark
+#define BENCH_MAP_SLOT MAX_FILES_NUM    // Mapping registry slot used by the benchmark
 
 // management Capability Lists
 typedef struct {
@@ -19,12 +51,77 @@ typedef struct {
     off_t size;               // File size
     char last_modified[20];   // last date modified time (ex: 2024/12/08 09:31)
     bool isModified;          // currently being modified
+    bool deleted;             // tombstone, the slot can be reused
+    unsigned long version;    // bumped on every change, sent with watch events
+    uint32_t checksum;        // CRC32C of the content, kept up to date by writes
+    time_t checked_at;        // last time the checksum was computed or verified
+    bool corrupted;           // file content does not match the checksum
 } Capability;
 
 Capability file_list[MAX_FILES_NUM];    // store file information
-int file_num = 0;                       // current file count
+int file_num = 0;                       // slots in use so far (including tombstones)
+int free_slots[MAX_FILES_NUM];          // tombstoned slots ready for reuse
+int free_num = 0;                       // number of free slots
+long trash_seq = 0;                     // unique suffix for trash names
+pthread_mutex_t catalog_lock = PTHREAD_MUTEX_INITIALIZER;   // protect slot allocation
+
+// deleted file waiting to be unlinked
+typedef struct ReclaimItem {
+    char path[300];
+    struct ReclaimItem *next;
+} ReclaimItem;
+
+ReclaimItem *reclaim_head = NULL, *reclaim_tail = NULL;     // reclaimer queue
+pthread_mutex_t reclaim_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t reclaim_cond = PTHREAD_COND_INITIALIZER;
+
+// connection watching a file
+typedef struct {
+    int fd;                   // client socket
+    unsigned long generation; // connection generation, a reused socket number does not match
+    User user;                // subscriber, read permission is checked again on every event
+    char filename[256];       // name the watcher subscribed to, told when the watch is dropped
+} Watcher;
+
+// connections watching one file
+typedef struct {
+    Watcher watchers[MAX_WATCHERS];
+    int num;                  // number of watchers
+} WatchList;
+
+WatchList watch_list[MAX_FILES_NUM];                    // subscribers, indexed like file_list
+pthread_mutex_t watch_lock = PTHREAD_MUTEX_INITIALIZER; // protect watch_list
+pthread_mutex_t send_locks[MAX_FD];                     // one writer at a time per client socket
+
+// client connection state, indexed by socket
+typedef struct {
+    bool open;                // served by a client thread
+    bool busy;                // in the middle of a request
+    unsigned long generation; // bumped when the socket is closed (under its send lock)
+} Connection;
+
+Connection connections[MAX_FD];                         // connections to drain on shutdown
+int client_count = 0;                                   // running client threads
+pthread_mutex_t conn_lock = PTHREAD_MUTEX_INITIALIZER;  // protect connections and client_count
+pthread_cond_t conn_cond = PTHREAD_COND_INITIALIZER;    // a client thread ended
+
+// shared read-only mapping of a file (one per catalog entry)
+typedef struct {
+    void *addr;               // start of the mapping
+    size_t len;               // mapped length (file size when mapped)
+    ino_t ino;                // mapped inode, a replaced file does not match
+    int refcount;             // registry reference + active readers
+} MappedFile;
+
+MappedFile *file_maps[MAX_FILES_NUM + 1];               // mapping registry, indexed like file_list (+ benchmark slot)
+pthread_mutex_t map_lock = PTHREAD_MUTEX_INITIALIZER;   // protect file_maps and refcounts
+pthread_cond_t map_released = PTHREAD_COND_INITIALIZER; // a reader released a mapping
 
 volatile int server_running = 1;                        // server running status
+atomic_uint last_request_ms;                            // time of the latest client request (now_ms)
+int wakeup_pipe[2];                                     // wakes the accept loop on shutdown
+char *server_path;                                      // binary started on hot restart
+int handoff_fd = -1;                                    // connection to the new server (hot restart)
 
 // 格式化結果
 void format_result(Response *res, const char *status, const char *content) {
@@ -39,6 +136,11 @@ void format_result(Response *res, const char *status, const char *content) {
         res->content[0] = '\0'; 
 }
 
+// check filename format: stays inside FILE_DIRECTORY and does not clash with server files (.trash, .tmp)
+bool correctFilenameFormat(const char* filename){
+    return filename != NULL && filename[0] != '\0' && filename[0] != '.' && strchr(filename, '/') == NULL;
+}
+
 // check permission format
 bool correctPermissionFormat(char* permission){
     if (strlen(permission) != PERMISSION_LEN) return false;
@@ -52,17 +154,996 @@ bool correctPermissionFormat(char* permission){
     return true;
 }
 
+// map a whole file read-only, return NULL for empty or unreadable files
+void *map_path(const char *path, size_t *len) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);  // the mapping stays valid after close
+    if (addr == MAP_FAILED) return NULL;
+
+    *len = st.st_size;
+    return addr;
+}
+
+// drop one reference, unmap when nobody uses the mapping (map_lock held)
+void map_put_locked(MappedFile *map) {
+    if (--map->refcount == 0) {
+        munmap(map->addr, map->len);
+        free(map);
+    }
+}
+
+// get the shared mapping of file_list[index], create it on first use
+MappedFile *map_acquire(int index, const char *filepath) {
+    // the file may have been changed outside the server, compare the mapping with the file on disk
+    int fd = open(filepath, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&map_lock);
+
+    // a writer owns the file (set before map_drain/map_invalidate take map_lock) --> caller reads with stdio
+    if (index < MAX_FILES_NUM && file_list[index].isModified) {
+        pthread_mutex_unlock(&map_lock);
+        close(fd);
+        return NULL;
+    }
+
+    MappedFile *map = file_maps[index];
+    if (map != NULL && (map->len != (size_t)st.st_size || map->ino != st.st_ino)) {
+        // shrunk or replaced --> copying the old length would fault past EOF
+        map_put_locked(map);
+        file_maps[index] = NULL;
+        map = NULL;
+    }
+    if (map == NULL && st.st_size > 0) {
+        map = malloc(sizeof(MappedFile));
+        void *addr = map != NULL ? mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+        if (addr != MAP_FAILED) {
+            map->addr = addr;
+            map->len = st.st_size;
+            map->ino = st.st_ino;
+            madvise(map->addr, map->len, MADV_SEQUENTIAL);  // readers stream from the start
+            map->refcount = 1;                              // reference held by the registry
+            file_maps[index] = map;
+        }
+        else {
+            free(map);
+            map = NULL;
+        }
+    }
+    if (map != NULL) map->refcount++;
+
+    pthread_mutex_unlock(&map_lock);
+    close(fd);  // the mapping stays valid after close
+    return map;
+}
+
+// reader is done with the mapping
+void map_release(MappedFile *map) {
+    pthread_mutex_lock(&map_lock);
+    map_put_locked(map);
+    pthread_cond_broadcast(&map_released);
+    pthread_mutex_unlock(&map_lock);
+}
+
+// file content changed: detach the mapping, readers still holding it keep it alive
+void map_invalidate(int index) {
+    pthread_mutex_lock(&map_lock);
+    if (file_maps[index] != NULL) {
+        map_put_locked(file_maps[index]);
+        file_maps[index] = NULL;
+    }
+    pthread_mutex_unlock(&map_lock);
+}
+
+// detach the mapping and wait until its readers are gone (before shrinking the file)
+void map_drain(int index) {
+    pthread_mutex_lock(&map_lock);
+    MappedFile *map = file_maps[index];
+    if (map != NULL) {
+        file_maps[index] = NULL;
+        while (map->refcount > 1) 
+            pthread_cond_wait(&map_released, &map_lock);
+        map_put_locked(map);
+    }
+    pthread_mutex_unlock(&map_lock);
+}
+
+// copy the head of a mapping into the response
+void format_from_map(Response *res, const char *status, const MappedFile *map) {
+    size_t len = map->len < sizeof(res->content) - 1 ? map->len : sizeof(res->content) - 1;
+
+    madvise(map->addr, len, MADV_WILLNEED);   // prefetch the range we are about to send
+    format_result(res, status, "");
+    memcpy(res->content, map->addr, len);
+    res->content[len] = '\0';
+}
+
+uint32_t crc32c_table[256];     // software CRC32C (Castagnoli, reflected)
+
+void crc32c_init() {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t crc = n;
+        for (int k = 0; k < 8; k++) 
+            crc = crc & 1 ? (crc >> 1) ^ 0x82F63B78u : crc >> 1;
+        crc32c_table[n] = crc;
+    }
+}
+
+uint32_t crc32c_soft(uint32_t crc, const unsigned char *data, size_t len) {
+    while (len--) 
+        crc = crc32c_table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__x86_64__)
+// SSE4.2 crc32 instruction, 8 bytes per step
+__attribute__((target("sse4.2")))
+uint32_t crc32c_sse42(uint32_t crc, const unsigned char *data, size_t len) {
+    uint64_t crc64 = crc;
+    for (; len >= 8; len -= 8, data += 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc64 = __builtin_ia32_crc32di(crc64, word);
+    }
+    crc = (uint32_t)crc64;
+    for (; len > 0; len--) 
+        crc = __builtin_ia32_crc32qi(crc, *data++);
+    return crc;
+}
+#endif
+
+// extend a CRC32C with more data, crc32c_update(crc32c_update(0, a), b) == CRC32C of a followed by b
+uint32_t crc32c_update(uint32_t crc, const void *data, size_t len) {
+    crc = ~crc;
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) return ~crc32c_sse42(crc, data, len);
+#endif
+    return ~crc32c_soft(crc, data, len);
+}
+
+// CRC32C of a whole file, read() in chunks so a file shrunk outside the server cannot fault
+bool file_checksum(const char *path, uint32_t *crc) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    unsigned char buffer[CHECKSUM_CHUNK];
+    uint32_t sum = 0;
+    ssize_t read_size;
+    while ((read_size = read(fd, buffer, sizeof(buffer))) > 0) 
+        sum = crc32c_update(sum, buffer, read_size);
+    close(fd);
+
+    if (read_size < 0) return false;
+    *crc = sum;
+    return true;
+}
+
+// audit log record, stored in fixed-size slots so record n lives at n * sizeof(LogRecord)
+typedef struct {
+    int64_t time;             // time of the action
+    char user[50];            // user who did the action
+    char action[16];          // create, read, write, mode ...
+    char filename[256];       // target file
+    char status[32];          // result of the action
+} LogRecord;
+
+// sorted index entry of a sealed segment
+typedef struct {
+    uint32_t key;             // hash of the user or the filename
+    uint32_t record;          // record number inside the segment
+} LogIndexEntry;
+
+// filters of an admin log query (NULL or 0 means no filter)
+typedef struct {
+    const char *user;
+    const char *filename;
+    const char *action;
+    const char *status;
+    int64_t from;
+    int64_t to;
+} LogQuery;
+
+int log_segment = 0;                                    // active segment number
+int log_records = 0;                                    // records in the active segment
+int log_fd = -1;                                        // active segment file
+int64_t log_last_time = 0;                              // time of the latest record, records never go back
+pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;   // serialize log appends
+
+// path of a segment file (ext: dat, uidx, fidx)
+void log_path(char *path, size_t size, int segment, const char *ext) {
+    snprintf(path, size, "%s/seg_%06d.%s", LOG_DIRECTORY, segment, ext);
+}
+
+// FNV-1a hash for the user and file indexes
+uint32_t log_hash(const char *str) {
+    uint32_t hash = 2166136261u;
+    while (*str) {
+        hash ^= (unsigned char)*str++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+int index_compare(const void *a, const void *b) {
+    const LogIndexEntry *x = a, *y = b;
+    if (x->key != y->key) return x->key < y->key ? -1 : 1;
+    return x->record < y->record ? -1 : x->record > y->record;
+}
+
+// write one sorted index file of a full segment
+void log_write_index(int segment, const char *ext, LogIndexEntry *entries, int count) {
+    char path[256];
+    log_path(path, sizeof(path), segment, ext);
+
+    qsort(entries, count, sizeof(LogIndexEntry), index_compare);
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        perror("Failed to write log index");
+        return;
+    }
+    fwrite(entries, sizeof(LogIndexEntry), count, file);
+    fclose(file);
+}
+
+// build the user and file indexes of a full segment
+void log_seal(int segment) {
+    char path[256];
+    size_t len;
+    log_path(path, sizeof(path), segment, "dat");
+
+    const LogRecord *records = map_path(path, &len);
+    if (records == NULL) return;
+    int count = len / sizeof(LogRecord);
+
+    LogIndexEntry *users = malloc(count * sizeof(LogIndexEntry));
+    LogIndexEntry *files = malloc(count * sizeof(LogIndexEntry));
+    if (users != NULL && files != NULL) {
+        for (int i = 0; i < count; i++) {
+            users[i].key = log_hash(records[i].user);
+            users[i].record = i;
+            files[i].key = log_hash(records[i].filename);
+            files[i].record = i;
+        }
+        log_write_index(segment, "uidx", users, count);
+        log_write_index(segment, "fidx", files, count);
+    }
+
+    free(users);
+    free(files);
+    munmap((void *)records, len);
+}
+
+// open the active segment, seal it first if it is already full (log_lock held)
+void log_open_segment() {
+    char path[256];
+    struct stat st;
+
+    if (stat(LOG_DIRECTORY, &st) == -1) 
+        mkdir(LOG_DIRECTORY, 0700);
+
+    // segments are numbered consecutively, continue from the last one
+    log_path(path, sizeof(path), log_segment, "dat");
+    while (stat(path, &st) == 0) {
+        log_records = st.st_size / sizeof(LogRecord);
+        if (log_records < LOG_SEGMENT_RECORDS) break;
+
+        char index[256];
+        log_path(index, sizeof(index), log_segment, "fidx");
+        if (stat(index, &st) == -1) log_seal(log_segment);
+
+        log_segment++;
+        log_records = 0;
+        log_path(path, sizeof(path), log_segment, "dat");
+    }
+
+    log_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (log_fd < 0) perror("Failed to open log segment");
+
+    // continue from the latest record on disk, the clock may be behind it after a restart
+    int segment = log_records > 0 ? log_segment : log_segment - 1;
+    int record = log_records > 0 ? log_records - 1 : LOG_SEGMENT_RECORDS - 1;
+    if (segment >= 0) {
+        log_path(path, sizeof(path), segment, "dat");
+        int fd = open(path, O_RDONLY);
+        LogRecord last;
+        if (fd >= 0 && pread(fd, &last, sizeof(last), (off_t)record * sizeof(LogRecord)) == sizeof(last) && 
+            last.time > log_last_time) 
+            log_last_time = last.time;
+        if (fd >= 0) close(fd);
+    }
+}
+
 // log record
 void log_add(const char* user, const char* action, const char* filename, const char* status) {
-    
+
+    LogRecord record;
+    memset(&record, 0, sizeof(record));
+    strncpy(record.user, user, sizeof(record.user) - 1);
+    strncpy(record.action, action, sizeof(record.action) - 1);
+    strncpy(record.filename, filename, sizeof(record.filename) - 1);
+    strncpy(record.status, status, sizeof(record.status) - 1);
+
+    pthread_mutex_lock(&log_lock);
+    record.time = time(NULL);   // taken under the lock, queries rely on records being in time order
+    if (log_fd < 0) log_open_segment();
+    // the wall clock can step back, never write a record older than the previous one
+    if (record.time < log_last_time) record.time = log_last_time;
+    log_last_time = record.time;
+
+    if (log_fd >= 0 && write(log_fd, &record, sizeof(record)) == sizeof(record)) {
+        if (++log_records == LOG_SEGMENT_RECORDS) {  // segment full --> index it and start the next one
+            close(log_fd);
+            log_seal(log_segment);
+            log_segment++;
+            log_records = 0;
+            log_open_segment();
+        }
+    }
+    else perror("Failed to write log");
+    pthread_mutex_unlock(&log_lock);
+}
+
+// print a record in the plain-text log format
+void log_print(FILE *out, const LogRecord *record) {
     char timeNow[20];
-    time_t now = time(NULL);
-    struct tm* tm_info = localtime(&now);
+    time_t time = record->time;
+    struct tm* tm_info = localtime(&time);
     strftime(timeNow, sizeof(timeNow), "%Y/%m/%d %H:%M", tm_info);
 
-    FILE *log = fopen("socket.log", "a");
-    fprintf(log, "[%s] User: %s,\tAction: %s,\tFile: %s,\tStatus: %s\n", timeNow, user, action, filename, status);
-    fclose(log);
+    fprintf(out, "[%s] User: %s,\tAction: %s,\tFile: %s,\tStatus: %s\n", 
+        timeNow, record->user, record->action, record->filename, record->status);
+}
+
+bool log_match(const LogRecord *record, const LogQuery *query) {
+    return (!query->user || !strcmp(record->user, query->user)) &&
+           (!query->filename || !strcmp(record->filename, query->filename)) &&
+           (!query->action || !strcmp(record->action, query->action)) &&
+           (!query->status || !strcmp(record->status, query->status)) &&
+           record->time >= query->from && record->time <= query->to;
+}
+
+// first record in [lo, hi) with time >= t (records are appended in time order)
+int log_lower_bound(const LogRecord *records, int lo, int hi, int64_t t) {
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (records[mid].time < t) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// first index entry with key >= key
+int index_lower_bound(const LogIndexEntry *entries, int count, uint32_t key) {
+    int lo = 0, hi = count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (entries[mid].key < key) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// print the records of one segment that match the query, return the match count
+int log_query_segment(int segment, const LogQuery *query, FILE *out) {
+    char path[256];
+    size_t len;
+    log_path(path, sizeof(path), segment, "dat");
+
+    const LogRecord *records = map_path(path, &len);
+    if (records == NULL) return 0;
+    int count = len / sizeof(LogRecord);   // ignore a record still being appended
+    int matched = 0;
+
+    // time range --> record range
+    int lo = log_lower_bound(records, 0, count, query->from);
+    int hi = query->to == INT64_MAX ? count : log_lower_bound(records, lo, count, query->to + 1);
+
+    // sealed segments answer user/file filters from their index
+    const LogIndexEntry *entries = NULL;
+    size_t index_len = 0;
+    const char *key = query->user ? query->user : query->filename;
+    if (key && lo < hi) {
+        log_path(path, sizeof(path), segment, query->user ? "uidx" : "fidx");
+        entries = map_path(path, &index_len);
+    }
+
+    if (entries != NULL) {
+        int entry_num = index_len / sizeof(LogIndexEntry);
+        uint32_t hash = log_hash(key);
+        for (int e = index_lower_bound(entries, entry_num, hash); e < entry_num && entries[e].key == hash; e++) {
+            int r = entries[e].record;
+            if (r >= lo && r < hi && log_match(&records[r], query)) {
+                log_print(out, &records[r]);
+                matched++;
+            }
+        }
+        munmap((void *)entries, index_len);
+    }
+    else {  // active segment or no indexed filter --> scan the time range
+        for (int r = lo; r < hi; r++) {
+            if (log_match(&records[r], query)) {
+                log_print(out, &records[r]);
+                matched++;
+            }
+        }
+    }
+
+    munmap((void *)records, len);
+    return matched;
+}
+
+// print every record that matches the query
+int log_query(const LogQuery *query, FILE *out) {
+    pthread_mutex_lock(&log_lock);
+    int last = log_segment;
+    pthread_mutex_unlock(&log_lock);
+
+    int matched = 0;
+    for (int segment = 0; segment <= last; segment++)
+        matched += log_query_segment(segment, query, out);
+    return matched;
+}
+
+// print the last n records
+void log_tail(int n) {
+    pthread_mutex_lock(&log_lock);
+    int segment = log_segment;
+    int skip = (int)((int64_t)segment * LOG_SEGMENT_RECORDS + log_records) - n;  // records before the tail
+    pthread_mutex_unlock(&log_lock);
+
+    for (int s = skip > 0 ? skip / LOG_SEGMENT_RECORDS : 0; s <= segment; s++) {
+        char path[256];
+        size_t len;
+        log_path(path, sizeof(path), s, "dat");
+
+        const LogRecord *records = map_path(path, &len);
+        if (records == NULL) continue;
+        int count = len / sizeof(LogRecord);
+
+        int first = skip - s * LOG_SEGMENT_RECORDS;
+        for (int r = first > 0 ? first : 0; r < count; r++)
+            log_print(stdout, &records[r]);
+        munmap((void *)records, len);
+    }
+}
+
+// parse a query time (YYYY/MM/DD-HH:MM)
+bool parse_log_time(const char *str, int64_t *t) {
+    struct tm tm_info;
+    memset(&tm_info, 0, sizeof(tm_info));
+    if (sscanf(str, "%d/%d/%d-%d:%d", &tm_info.tm_year, &tm_info.tm_mon, &tm_info.tm_mday, 
+               &tm_info.tm_hour, &tm_info.tm_min) != 5) return false;
+
+    tm_info.tm_year -= 1900;
+    tm_info.tm_mon  -= 1;
+    tm_info.tm_isdst = -1;
+    *t = mktime(&tm_info);
+    return true;
+}
+
+// parse "key=value ..." filters of the admin query command
+bool parse_log_query(char *args, LogQuery *query) {
+    memset(query, 0, sizeof(LogQuery));
+    query->from = INT64_MIN;
+    query->to = INT64_MAX;
+
+    for (char *token = strtok(args, " "); token != NULL; token = strtok(NULL, " ")) {
+        char *value = strchr(token, '=');
+        if (value == NULL) return false;
+        *value++ = '\0';
+
+        if (!strcmp(token, "user"))          query->user = value;
+        else if (!strcmp(token, "file"))     query->filename = value;
+        else if (!strcmp(token, "action"))   query->action = value;
+        else if (!strcmp(token, "status")) {
+            // only statuses hold spaces, "permission_denied" means "permission denied"
+            for (char *c = value; *c; c++) 
+                if (*c == '_') *c = ' ';
+            query->status = value;
+        }
+        else if (!strcmp(token, "from"))     { if (!parse_log_time(value, &query->from)) return false; }
+        else if (!strcmp(token, "to"))       { if (!parse_log_time(value, &query->to)) return false; query->to += 59; }
+        else return false;
+    }
+    return true;
+}
+
+// usage and limits of one user or group
+typedef struct {
+    char name[50];            // user or group name
+    bool isGroup;             // group entry
+    atomic_bool used;         // slot is filled in (set last)
+    atomic_llong bytes_used;  // bytes in files owned by the identity
+    atomic_llong files_used;  // files owned by the identity
+    atomic_llong byte_quota;  // 0 means unlimited
+    atomic_llong file_quota;  // 0 means unlimited
+    atomic_int rate;          // requests per second, 0 means unlimited
+    atomic_uint_least64_t bucket;   // token bucket: milli-tokens (high 32 bits) | last refill in ms (low 32 bits)
+} Usage;
+
+Usage usage_list[MAX_IDENTITIES];                       // open addressing table of identities
+Usage default_limits[2];                                // limits for new users [0] and groups [1], shared by all
+                                                        // identities that do not fit in usage_list
+pthread_mutex_t usage_lock = PTHREAD_MUTEX_INITIALIZER; // serialize insertion, lookups are lock-free
+
+// monotonic milliseconds, wraps every ~49 days
+uint32_t now_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)(now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+// fill the token bucket
+void bucket_reset(Usage *usage) {
+    uint64_t burst = (uint64_t)atomic_load(&usage->rate) * RATE_BURST_SECONDS * 1000;
+    atomic_store(&usage->bucket, (burst << 32) | now_ms());
+}
+
+// find a user or group, create it with the default limits when asked
+// (NULL if not found, the shared default entry if the table is full so limits still apply)
+Usage *usage_find(const char *name, bool isGroup, bool create) {
+    uint32_t start = log_hash(name) % MAX_IDENTITIES;
+
+    // lock-free lookup, names never change once the slot is used
+    for (int n = 0; n < MAX_IDENTITIES; n++) {
+        Usage *usage = &usage_list[(start + n) % MAX_IDENTITIES];
+        if (!atomic_load_explicit(&usage->used, memory_order_acquire)) break;
+        if (usage->isGroup == isGroup && !strcmp(usage->name, name)) return usage;
+    }
+    if (!create) return NULL;
+
+    pthread_mutex_lock(&usage_lock);
+    Usage *found = NULL;
+    for (int n = 0; n < MAX_IDENTITIES && found == NULL; n++) {
+        Usage *usage = &usage_list[(start + n) % MAX_IDENTITIES];
+        if (atomic_load(&usage->used)) {
+            if (usage->isGroup == isGroup && !strcmp(usage->name, name)) found = usage;
+            continue;
+        }
+
+        Usage *limits = &default_limits[isGroup];
+        strncpy(usage->name, name, sizeof(usage->name) - 1);
+        usage->isGroup = isGroup;
+        atomic_store(&usage->bytes_used, 0);
+        atomic_store(&usage->files_used, 0);
+        atomic_store(&usage->byte_quota, atomic_load(&limits->byte_quota));
+        atomic_store(&usage->file_quota, atomic_load(&limits->file_quota));
+        atomic_store(&usage->rate, atomic_load(&limits->rate));
+        bucket_reset(usage);
+        atomic_store_explicit(&usage->used, true, memory_order_release);   // publish
+        found = usage;
+    }
+    pthread_mutex_unlock(&usage_lock);
+
+    return found != NULL ? found : &default_limits[isGroup];
+}
+
+// take one token, false when the identity is over its request rate
+bool bucket_take(Usage *usage) {
+    if (usage == NULL) return true;
+    int rate = atomic_load(&usage->rate);
+    if (rate <= 0) return true;
+
+    uint64_t burst = (uint64_t)rate * RATE_BURST_SECONDS * 1000;
+    uint64_t old = atomic_load(&usage->bucket);
+
+    while (1) {
+        // read the clock on every try, another thread may have stored a later timestamp meanwhile
+        uint32_t now = now_ms();
+        int32_t elapsed = (int32_t)(now - (uint32_t)old);
+        if (elapsed < 0) {      // never move the timestamp backwards
+            elapsed = 0;
+            now = (uint32_t)old;
+        }
+
+        uint64_t tokens = (old >> 32) + (uint64_t)elapsed * rate;  // rate tokens/s == rate milli-tokens/ms
+        if (tokens > burst) tokens = burst;
+        if (tokens < 1000) return false;
+
+        if (atomic_compare_exchange_weak(&usage->bucket, &old, ((tokens - 1000) << 32) | now)) return true;
+    }
+}
+
+// rate limit of a request, checked for the user and the group
+bool rate_allow(User client) {
+    return bucket_take(usage_find(client.name, false, true)) &&
+           bucket_take(usage_find(client.group, true, true));
+}
+
+// add delta to a counter unless it goes over the quota (releases always succeed)
+bool counter_reserve(atomic_llong *counter, long long quota, long long delta) {
+    long long old = atomic_fetch_add(counter, delta);
+    if (delta > 0 && quota > 0 && old + delta > quota) {
+        atomic_fetch_sub(counter, delta);
+        return false;
+    }
+    return true;
+}
+
+// charge bytes and files to the owner and group of a file, false (and nothing charged) when over quota
+bool quota_charge(const char *owner, const char *group, long long bytes, long long files) {
+    Usage *user = usage_find(owner, false, true);
+    Usage *team = usage_find(group, true, true);
+
+    if (!counter_reserve(&user->bytes_used, atomic_load(&user->byte_quota), bytes)) return false;
+    if (!counter_reserve(&team->bytes_used, atomic_load(&team->byte_quota), bytes)) {
+        atomic_fetch_sub(&user->bytes_used, bytes);
+        return false;
+    }
+    if (!counter_reserve(&user->files_used, atomic_load(&user->file_quota), files)) {
+        atomic_fetch_sub(&user->bytes_used, bytes);
+        atomic_fetch_sub(&team->bytes_used, bytes);
+        return false;
+    }
+    if (!counter_reserve(&team->files_used, atomic_load(&team->file_quota), files)) {
+        atomic_fetch_sub(&user->bytes_used, bytes);
+        atomic_fetch_sub(&team->bytes_used, bytes);
+        atomic_fetch_sub(&user->files_used, files);
+        return false;
+    }
+    return true;
+}
+
+// apply "user|group <name|*> [bytes=N] [files=N] [rate=N]", '*' changes the defaults for new identities
+bool quota_apply(char *args) {
+    char *type = strtok(args, " ");
+    char *name = strtok(NULL, " ");
+    if (type == NULL || name == NULL) return false;
+
+    bool isGroup;
+    if (!strcmp(type, "user"))        isGroup = false;
+    else if (!strcmp(type, "group"))  isGroup = true;
+    else return false;
+
+    Usage *usage = !strcmp(name, "*") ? &default_limits[isGroup] : usage_find(name, isGroup, true);
+    if (usage == &default_limits[isGroup] && strcmp(name, "*")) return false;  // table full
+
+    for (char *token = strtok(NULL, " "); token != NULL; token = strtok(NULL, " ")) {
+        long long value;
+        if (sscanf(token, "bytes=%lld", &value) == 1 && value >= 0)       atomic_store(&usage->byte_quota, value);
+        else if (sscanf(token, "files=%lld", &value) == 1 && value >= 0)  atomic_store(&usage->file_quota, value);
+        else if (sscanf(token, "rate=%lld", &value) == 1 && value >= 0 && value <= MAX_RATE_LIMIT) {
+            atomic_store(&usage->rate, (int)value);
+            bucket_reset(usage);
+        }
+        else return false;
+    }
+    return true;
+}
+
+// read the quota settings, one "user|group <name|*> key=value ..." per line
+void quota_load() {
+    FILE *config = fopen(QUOTA_CONFIG, "r");
+    if (config == NULL) return;
+
+    char line[256];
+    int line_num = 0;
+    while (fgets(line, sizeof(line), config) != NULL) {
+        line_num++;
+        line[strcspn(line, "\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') continue;
+        if (!quota_apply(line)) printf("%s:%d: invalid quota setting\n", QUOTA_CONFIG, line_num);
+    }
+    fclose(config);
+}
+
+// print a quota value
+void print_limit(long long used, long long limit) {
+    char text[48];
+    if (limit > 0) snprintf(text, sizeof(text), "%lld/%lld", used, limit);
+    else snprintf(text, sizeof(text), "%lld/-", used);
+    printf("%-22s", text);
+}
+
+// print one row of the quota table
+void print_usage(const Usage *usage, bool isGroup, const char *name) {
+    printf("%s\t%-18s  ", isGroup ? "group" : "user", name);
+    print_limit(atomic_load(&usage->bytes_used), atomic_load(&usage->byte_quota));
+    print_limit(atomic_load(&usage->files_used), atomic_load(&usage->file_quota));
+    if (atomic_load(&usage->rate) > 0) printf("%d\n", atomic_load(&usage->rate));
+    else printf("-\n");
+}
+
+// show usage and limits of every identity
+void quota_list() {
+    printf("Type\tName                Bytes                 Files                 Rate (req/s)\n");
+    printf("=================================================================================\n");
+
+    for (int n = 0; n < MAX_IDENTITIES; n++) {
+        Usage *usage = &usage_list[n];
+        if (atomic_load(&usage->used)) print_usage(usage, usage->isGroup, usage->name);
+    }
+
+    // defaults, their usage counts identities that did not fit in the table
+    print_usage(&default_limits[0], false, "*");
+    print_usage(&default_limits[1], true, "*");
+    printf("\n");
+}
+
+// stored checksum does not match the file: flag it and tell the admin
+void report_mismatch(int index, uint32_t actual) {
+    file_list[index].corrupted = true;
+    printf("\n[Warning] checksum mismatch on %s (stored %08x, actual %08x)\nadmin> ", 
+        file_list[index].filename, file_list[index].checksum, actual);
+    fflush(stdout);
+    log_add("server", "verify", file_list[index].filename, "checksum mismatch");
+}
+
+// find a live catalog entry by name, -1 if not found
+int find_file(const char* filename) {
+    for (int i = 0; i < file_num; i++)
+        if (!file_list[i].deleted && !strcmp(file_list[i].filename, filename)) return i;
+    return -1;
+}
+
+// take a catalog slot, reuse a tombstone first (-1 if the catalog is full)
+int catalog_alloc() {
+    int slot = -1;
+
+    pthread_mutex_lock(&catalog_lock);
+    if (free_num > 0) slot = free_slots[--free_num];
+    else if (file_num < MAX_FILES_NUM) {
+        slot = file_num;
+        file_list[slot].deleted = true;     // hidden until filled in
+        file_num++;
+    }
+    pthread_mutex_unlock(&catalog_lock);
+
+    return slot;
+}
+
+// tombstone a catalog slot and make it reusable
+void catalog_free(int slot) {
+    pthread_mutex_lock(&catalog_lock);
+    file_list[slot].deleted = true;
+    file_list[slot].isModified = false;
+    free_slots[free_num++] = slot;
+    pthread_mutex_unlock(&catalog_lock);
+}
+
+// hand a trashed file to the reclaimer thread
+void reclaim_enqueue(const char* path) {
+    ReclaimItem *item = malloc(sizeof(ReclaimItem));
+    if (item == NULL) {     // no memory --> unlink right here
+        unlink(path);
+        return;
+    }
+    snprintf(item->path, sizeof(item->path), "%s", path);
+    item->next = NULL;
+
+    pthread_mutex_lock(&reclaim_lock);
+    if (reclaim_tail) reclaim_tail->next = item;
+    else reclaim_head = item;
+    reclaim_tail = item;
+    pthread_cond_signal(&reclaim_cond);
+    pthread_mutex_unlock(&reclaim_lock);
+}
+
+// queue the files left in the trash by a previous run
+void reclaim_leftovers() {
+    DIR *dir = opendir(TRASH_DIRECTORY);
+    if (dir == NULL) return;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+
+        char path[300];
+        snprintf(path, sizeof(path), "%s/%s", TRASH_DIRECTORY, entry->d_name);
+        reclaim_enqueue(path);
+    }
+    closedir(dir);
+}
+
+// unlink deleted files in the background so requests never wait for it
+void *reclaimer_handler() {
+    while (1) {
+        pthread_mutex_lock(&reclaim_lock);
+        while (reclaim_head == NULL) 
+            pthread_cond_wait(&reclaim_cond, &reclaim_lock);
+
+        ReclaimItem *item = reclaim_head;
+        reclaim_head = item->next;
+        if (reclaim_head == NULL) reclaim_tail = NULL;
+        pthread_mutex_unlock(&reclaim_lock);
+
+        if (unlink(item->path) < 0 && errno != ENOENT) perror("Failed to reclaim file");
+        free(item);
+    }
+    return NULL;
+}
+
+// send a response, serialized with the watch events pushed to the same connection
+int send_response(int client_fd, Response *res) {
+    if (client_fd >= MAX_FD) return send(client_fd, res, sizeof(Response), MSG_NOSIGNAL);
+
+    pthread_mutex_lock(&send_locks[client_fd]);
+    int sent = send(client_fd, res, sizeof(Response), MSG_NOSIGNAL);
+    pthread_mutex_unlock(&send_locks[client_fd]);
+    return sent;
+}
+
+// remove a connection from one watch list, false if it was not watching
+bool watch_remove(int index, int client_fd, unsigned long generation) {
+    bool found = false;
+
+    pthread_mutex_lock(&watch_lock);
+    WatchList *list = &watch_list[index];
+    for (int n = 0; n < list->num; n++) {
+        if (list->watchers[n].fd == client_fd && list->watchers[n].generation == generation) {
+            list->watchers[n] = list->watchers[--list->num];   // order does not matter
+            found = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&watch_lock);
+
+    return found;
+}
+
+// client can read file_list[index]
+bool hasReadPermission(int index, User client) {
+    return  // Open to everyone
+            (file_list[index].permissions[4] == 'r') ||  
+            // The group the client belongs to has read permissions
+            (!strcmp(file_list[index].group, client.group) && file_list[index].permissions[2] == 'r') ||
+            // client is the owner
+            (!strcmp(file_list[index].owner, client.name));
+}
+
+// send an event without blocking the writer, false if the watcher fell behind (it gets dropped)
+bool push_event(const Watcher *watcher, Response *res) {
+    int client_fd = watcher->fd;
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += WATCH_PUSH_WAIT_MS * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    // the connection is stuck sending something else
+    if (pthread_mutex_timedlock(&send_locks[client_fd], &deadline) != 0) return false;
+
+    // closed meanwhile (close holds the send lock), the number may belong to another client now
+    if (connections[client_fd].generation != watcher->generation) {
+        pthread_mutex_unlock(&send_locks[client_fd]);
+        return false;
+    }
+
+    ssize_t sent = send(client_fd, res, sizeof(Response), MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (sent > 0 && sent < (ssize_t)sizeof(Response)) 
+        shutdown(client_fd, SHUT_RDWR);     // half an event on the wire, the stream is lost
+    pthread_mutex_unlock(&send_locks[client_fd]);
+
+    return sent == sizeof(Response);
+}
+
+// push an event about file_list[index] to every connection watching it
+// the watch is gone: tell the client so it can fall back to polling, end the connection if even that fails
+void watch_drop(int index, const Watcher *watcher) {
+    watch_remove(index, watcher->fd, watcher->generation);
+
+    Response res;
+    format_result(&res, "Watch event: subscription dropped", watcher->filename);
+    if (push_event(watcher, &res)) return;
+
+    // generation is bumped under conn_lock before close --> a matching one is still this client's socket
+    pthread_mutex_lock(&conn_lock);
+    if (connections[watcher->fd].generation == watcher->generation) shutdown(watcher->fd, SHUT_RDWR);
+    pthread_mutex_unlock(&conn_lock);
+}
+
+void notify_watchers(int index, const char *event) {
+    Watcher watchers[MAX_WATCHERS];
+
+    pthread_mutex_lock(&watch_lock);
+    int num = watch_list[index].num;
+    memcpy(watchers, watch_list[index].watchers, num * sizeof(Watcher));
+    pthread_mutex_unlock(&watch_lock);
+    if (num == 0) return;
+
+    // event content: filename,size,last modified,version
+    char content[512];
+    snprintf(content, sizeof(content), "%s,%ld,%s,%lu", 
+        file_list[index].filename, (long)file_list[index].size, 
+        file_list[index].last_modified, file_list[index].version);
+
+    Response res;
+    format_result(&res, event, content);
+    for (int n = 0; n < num; n++) {
+        // mode may have taken the access away --> drop the watch without sending the event
+        if (!hasReadPermission(index, watchers[n].user) || !push_event(&watchers[n], &res)) 
+            watch_drop(index, &watchers[n]);
+    }
+}
+
+// stop all watches of file_list[index] (file deleted)
+void watch_clear(int index) {
+    pthread_mutex_lock(&watch_lock);
+    watch_list[index].num = 0;
+    pthread_mutex_unlock(&watch_lock);
+}
+
+// connection closed --> drop its watches
+void watch_drop_connection(int client_fd) {
+    for (int i = 0; i < file_num; i++) 
+        watch_remove(i, client_fd, connections[client_fd].generation);
+}
+
+// subscribe to change events of a file
+void watch_file(int client_fd, User client, const char* filename) {
+
+    Response res;
+    int i = find_file(filename);
+    if (i < 0) {
+        format_result(&res, "File not found", "");
+        send_response(client_fd, &res);
+        return;
+    }
+
+    if (!hasReadPermission(i, client)) {
+        format_result(&res, "Permission denied", "");
+        send_response(client_fd, &res);
+        log_add(client.name, "watch", filename, "permission denied");
+        return;
+    }
+
+    const char *status = "Watching file";
+    Watcher watcher = {client_fd, connections[client_fd].generation, client, ""};
+    strcpy(watcher.filename, file_list[i].filename);
+    pthread_mutex_lock(&watch_lock);
+    WatchList *list = &watch_list[i];
+    bool watching = false;
+    for (int n = 0; n < list->num; n++) 
+        if (list->watchers[n].fd == client_fd && list->watchers[n].generation == watcher.generation) watching = true;
+
+    if (watching)                           status = "Already watching file";
+    else if (list->num == MAX_WATCHERS)     status = "Too many watchers";
+    else                                    list->watchers[list->num++] = watcher;
+    pthread_mutex_unlock(&watch_lock);
+
+    // reply with the current state so the client knows where it starts from
+    char content[512];
+    snprintf(content, sizeof(content), "%s,%ld,%s,%lu", 
+        file_list[i].filename, (long)file_list[i].size, file_list[i].last_modified, file_list[i].version);
+    format_result(&res, status, content);
+    send_response(client_fd, &res);
+    log_add(client.name, "watch", filename, "success");
+}
+
+// unsubscribe from a file
+void unwatch_file(int client_fd, User client, const char* filename) {
+
+    Response res;
+    int i = find_file(filename);
+    if (i < 0) {
+        format_result(&res, "File not found", "");
+        send_response(client_fd, &res);
+        return;
+    }
+
+    if (watch_remove(i, client_fd, connections[client_fd].generation)) {
+        format_result(&res, "Stopped watching file", "");
+        log_add(client.name, "unwatch", filename, "success");
+    }
+    else format_result(&res, "Not watching file", "");
+    send_response(client_fd, &res);
 }
 
 // list accessible files
@@ -71,6 +1152,8 @@ void list_file(int client_fd, User client){
     char accessiabled_files[CONTENT_SIZE] = "";
 
     for(int i = 0; i < file_num; i++){
+        if (file_list[i].deleted) continue;
+
         if (// allow access for everyone
             (file_list[i].permissions[4] == 'r') ||  (file_list[i].permissions[5] == 'w') ||
             // The group the client belongs to has read permissions
@@ -90,7 +1173,7 @@ void list_file(int client_fd, User client){
 
     Response res;
     format_result(&res, "List accessiable files successful", accessiabled_files);
-    send(client_fd, &res, sizeof(res), 0);
+    send_response(client_fd, &res);
 }
 
 // Create profile
@@ -98,16 +1181,26 @@ void create_file(int client_fd, User client, const char* filename, const char* p
 
     // Check if the file exists
     for (int i = 0; i < file_num; i++) {
-        if (!strcmp(file_list[i].filename, filename)) { // found
+        if (!file_list[i].deleted && !strcmp(file_list[i].filename, filename)) { // found
             Response res;
             format_result(&res, "File already exists", "");   
-            send(client_fd, &res, sizeof(res), 0);
+            send_response(client_fd, &res);
             return;
         }
     }
 
-    // File does not exist --> Create
-    if (file_num < MAX_FILES_NUM) {
+    // File does not exist --> check the file count quota
+    if (!quota_charge(client.name, client.group, 0, 1)) {
+        Response res;
+        format_result(&res, "File quota exceeded", "");
+        send_response(client_fd, &res);
+        log_add(client.name, "create", filename, "quota exceeded");
+        return;
+    }
+
+    // Create
+    int slot = catalog_alloc();
+    if (slot >= 0) {
 
         // Make sure the folder where the file is stored exists
         struct stat st;
@@ -121,47 +1214,55 @@ void create_file(int client_fd, User client, const char* filename, const char* p
         FILE *file = fopen(filepath, "w");
         if (file == NULL) {
             perror("Failed to create file");
+            catalog_free(slot);
+            quota_charge(client.name, client.group, 0, -1);
 
             Response res;
             format_result(&res, "Failed to create file", "");
-            send(client_fd, &res, sizeof(res), 0);
+            send_response(client_fd, &res);
 
             return;
         }
         fclose(file);
 
         // renew file list
-        strcpy(file_list[file_num].filename, filename);
-        strcpy(file_list[file_num].permissions, permissions);
-        strcpy(file_list[file_num].owner, client.name);
-        strcpy(file_list[file_num].group, client.group);
-        file_list[file_num].size = 0; 
-        file_list[file_num].isModified = false;  
+        strcpy(file_list[slot].filename, filename);
+        strcpy(file_list[slot].permissions, permissions);
+        strcpy(file_list[slot].owner, client.name);
+        strcpy(file_list[slot].group, client.group);
+        file_list[slot].size = 0; 
+        file_list[slot].isModified = false;  
+        file_list[slot].version = 0;
+        file_list[slot].checksum = 0;       // CRC32C of an empty file
+        file_list[slot].checked_at = time(NULL);
+        file_list[slot].corrupted = false;
 
         // Set last modified time
         time_t now = time(NULL);
         struct tm* tm_info = localtime(&now);
-        strftime(file_list[file_num].last_modified, sizeof(file_list[file_num].last_modified), "%Y/%m/%d %H:%M", tm_info);
+        strftime(file_list[slot].last_modified, sizeof(file_list[slot].last_modified), "%Y/%m/%d %H:%M", tm_info);
 
-        file_num++;
+        file_list[slot].deleted = false;    // publish the entry
         log_add(client.name, "create", filename, "success");
 
         Response res;
         format_result(&res, "File created successfully", "");
-        send(client_fd, &res, sizeof(res), 0);
+        send_response(client_fd, &res);
     } 
     else {
+        quota_charge(client.name, client.group, 0, -1);
+
         Response res;
         format_result(&res, "File limit reached", "");
-        send(client_fd, &res, sizeof(res), 0);
+        send_response(client_fd, &res);
     }
 }
 
 // Read file
-void read_file(int client_fd, User client, const char* filename) {
+void read_file(int client_fd, User client, const char* filename, bool verify) {
 
     for (int i = 0; i < file_num; i++) {
-        if (!strcmp(file_list[i].filename, filename)) { // There is this file
+        if (!file_list[i].deleted && !strcmp(file_list[i].filename, filename)) { // There is this file
 
             if( // Open to everyone
                 (file_list[i].permissions[4] == 'r') ||  
@@ -173,19 +1274,67 @@ void read_file(int client_fd, User client, const char* filename) {
                 if(file_list[i].isModified){
                     Response res;
                     format_result(&res, "File is modifying", "");
-                    send(client_fd, &res, sizeof(res), 0);
+                    send_response(client_fd, &res);
                     return;
                 }
 
                 char filepath[512];  // file path
                 snprintf(filepath, sizeof(filepath), "%s//%s", FILE_DIRECTORY, filename);
 
+                // check the content against the stored checksum first
+                const char *status = "File read successful";
+                if (verify) {
+                    unsigned long version = file_list[i].version;
+                    uint32_t stored = file_list[i].checksum;
+                    uint32_t crc;
+                    if (!file_checksum(filepath, &crc)) {
+                        Response res;
+                        format_result(&res, "Failed to verify file", "");
+                        send_response(client_fd, &res);
+                        log_add(client.name, "read", filename, "failed");
+                        return;
+                    }
+
+                    // a write landed while hashing --> the result means nothing
+                    if (file_list[i].isModified || file_list[i].version != version) {
+                        Response res;
+                        format_result(&res, "File is modifying", "");
+                        send_response(client_fd, &res);
+                        return;
+                    }
+
+                    if (crc != stored) {
+                        report_mismatch(i, crc);
+
+                        Response res;
+                        format_result(&res, "Checksum mismatch", "The file content does not match its checksum.");
+                        send_response(client_fd, &res);
+                        log_add(client.name, "read", filename, "checksum mismatch");
+                        return;
+                    }
+                    file_list[i].checked_at = time(NULL);
+                    status = "File read successful (checksum verified)";
+                }
+
+                // large files are served from the shared mapping
+                if (file_list[i].size >= MMAP_THRESHOLD) {
+                    MappedFile *map = map_acquire(i, filepath);
+                    if (map != NULL) {
+                        Response res;
+                        format_from_map(&res, status, map);
+                        map_release(map);
+                        send_response(client_fd, &res);
+                        log_add(client.name, "read", filename, "success");
+                        return;
+                    }
+                }
+
                 FILE *file = fopen(filepath, "r");
                 if (file == NULL) { // Unable to open file
                     perror("Failed to open file");
                     Response res;
                     format_result(&res, "Failed to read file", "");
-                    send(client_fd, &res, sizeof(res), 0);
+                    send_response(client_fd, &res);
                     log_add(client.name, "read", filename, "failed");
                 } 
                 else {              // File opened successfully
@@ -195,15 +1344,15 @@ void read_file(int client_fd, User client, const char* filename) {
                     fclose(file);
                     
                     Response res;
-                    format_result(&res, "File read successful", file_content);
-                    send(client_fd, &res, sizeof(res), 0);
+                    format_result(&res, status, file_content);
+                    send_response(client_fd, &res);
                     log_add(client.name, "read", filename, "success");
                 }
             }
             else {  
                 Response res;
                 format_result(&res, "Permission denied", "");
-                send(client_fd, &res, sizeof(res), 0);
+                send_response(client_fd, &res);
                 log_add(client.name, "read", filename, "permission denied");
             }
             return;
@@ -213,7 +1362,7 @@ void read_file(int client_fd, User client, const char* filename) {
     // file not found
     Response res;
     format_result(&res, "File not found", "");
-    if (send(client_fd, &res, sizeof(Response), 0) < 0) 
+    if (send_response(client_fd, &res) < 0) 
         perror("Send failed");
 }
 
@@ -221,11 +1370,11 @@ void read_file(int client_fd, User client, const char* filename) {
 void write_file(int client_fd, User client, const char* filename, const char* write_mode) {
 
     for (int i = 0; i < file_num; i++) {
-        if (!strcmp(file_list[i].filename, filename)) { // found
+        if (!file_list[i].deleted && !strcmp(file_list[i].filename, filename)) { // found
             if(file_list[i].isModified){
                 Response res;
                 format_result(&res, "File is modifying", "");
-                send(client_fd, &res, sizeof(res), 0);
+                send_response(client_fd, &res);
                 return;
             }
 
@@ -250,7 +1399,7 @@ void write_file(int client_fd, User client, const char* filename, const char* wr
                     perror("Failed to open file");
                     Response res;
                     format_result(&res, "Failed to get file content", "");
-                    send(client_fd, &res, sizeof(res), 0);
+                    send_response(client_fd, &res);
                     log_add(client.name, "write", filename, "failed");
                 } 
                 else {              // File opened successfully
@@ -261,7 +1410,7 @@ void write_file(int client_fd, User client, const char* filename, const char* wr
 
                     Response res;
                     format_result(&res, "Ready for writing the file", file_content);
-                    send(client_fd, &res, sizeof(res), 0);
+                    send_response(client_fd, &res);
                 }
 
                 // receive content from client
@@ -270,27 +1419,55 @@ void write_file(int client_fd, User client, const char* filename, const char* wr
                 if (read_size <= 0) {
                     perror("Failed to receive content");
                     format_result(&res, "Failed to receive content", "");
-                    send(client_fd, &res, sizeof(res), 0);
+                    send_response(client_fd, &res);
                     log_add(client.name, "write", filename, "failed");
                     file_list[i].isModified = false;
                     return;
                 }
                 content[read_size] = '\0';  // make sure the string ends
 
+                // charge the growth of the file to its owner and group
+                off_t new_size = strlen(content) + (strcmp(write_mode, "o") ? file_list[i].size : 0);
+                long long delta = new_size - file_list[i].size;
+                if (!quota_charge(file_list[i].owner, file_list[i].group, delta, 0)) {
+                    format_result(&res, "Byte quota exceeded", "");
+                    send_response(client_fd, &res);
+                    log_add(client.name, "write", filename, "quota exceeded");
+                    file_list[i].isModified = false;
+                    return;
+                }
+
                 // write file
                 if (!strcmp(write_mode, "o")){  // overwrite
-                    file = fopen(filepath, "w");
+                    // write a new file and rename it over the old one, so mapped readers never see a truncated file
+                    char tmppath[520];
+                    snprintf(tmppath, sizeof(tmppath), "%s//.%s.tmp", FILE_DIRECTORY, filename);
+
+                    file = fopen(tmppath, "w");
                     if (file == NULL) {
                         perror("Failed to open file for overwriting");
                         format_result(&res, "Failed to overwrite file", "");
-                        send(client_fd, &res, sizeof(res), 0);
+                        send_response(client_fd, &res);
                         log_add(client.name, "write", filename, "failed");
+                        quota_charge(file_list[i].owner, file_list[i].group, -delta, 0);
                         file_list[i].isModified = false;
                         return;
                     }
                     
                     fprintf(file, "%s", content);  // overwrite content
                     fclose(file);
+                    if (rename(tmppath, filepath) < 0) {
+                        perror("Failed to replace file");
+                        unlink(tmppath);
+                        format_result(&res, "Failed to overwrite file", "");
+                        send_response(client_fd, &res);
+                        log_add(client.name, "write", filename, "failed");
+                        quota_charge(file_list[i].owner, file_list[i].group, -delta, 0);
+                        file_list[i].isModified = false;
+                        return;
+                    }
+                    file_list[i].checksum = crc32c_update(0, content, strlen(content));
+                    file_list[i].corrupted = false;
                     format_result(&res, "File overwritten", "");
                 }
                 else { // additional
@@ -298,14 +1475,16 @@ void write_file(int client_fd, User client, const char* filename, const char* wr
                     if (file == NULL) {
                         perror("Failed to open file for appending");
                         format_result(&res, "Failed to append content", "");
-                        send(client_fd, &res, sizeof(res), 0);
+                        send_response(client_fd, &res);
                         log_add(client.name, "write", filename, "failed");
+                        quota_charge(file_list[i].owner, file_list[i].group, -delta, 0);
                         file_list[i].isModified = false;
                         return;
                     }
                     
                     fprintf(file, "%s", content);  // additional content
                     fclose(file);
+                    file_list[i].checksum = crc32c_update(file_list[i].checksum, content, strlen(content));
                     format_result(&res, "Content appended", "");
                 }
 
@@ -313,19 +1492,34 @@ void write_file(int client_fd, User client, const char* filename, const char* wr
                 struct stat st;
                 if (stat(filepath, &st) == 0)  file_list[i].size = st.st_size;  
                 else perror("Failed to get file size");
+                if (file_list[i].size != new_size) {   // the file was changed outside the server
+                    quota_charge(file_list[i].owner, file_list[i].group, file_list[i].size - new_size, 0);
+                    // keep the stored checksum, the outside edit must show up as a mismatch
+                    uint32_t crc = 0;
+                    file_checksum(filepath, &crc);
+                    if (crc != file_list[i].checksum) report_mismatch(i, crc);
+                }
+                file_list[i].checked_at = time(NULL);
+                map_invalidate(i);  // old mapping no longer matches the file
 
                 // update last modified time
                 time_t now = time(NULL);
                 struct tm* tm_info = localtime(&now);
                 strftime(file_list[i].last_modified, sizeof(file_list[i].last_modified), "%Y/%m/%d %H:%M", tm_info);
 
-                send(client_fd, &res, sizeof(res), 0);
+                file_list[i].version++;
+                send_response(client_fd, &res);
                 log_add(client.name, "write", filename, "success");
+
+                // release the file first, watchers are notified outside the write
+                file_list[i].isModified = false;
+                notify_watchers(i, "Watch event: file changed");
+                return;
             }
             else {
                 Response res;
                 format_result(&res, "Permission denied", "");
-                send(client_fd, &res, sizeof(res), 0);
+                send_response(client_fd, &res);
                 log_add(client.name, "write", filename, "permission denied");
             }
             file_list[i].isModified = false;
@@ -335,25 +1529,27 @@ void write_file(int client_fd, User client, const char* filename, const char* wr
 
     Response res;
     format_result(&res, "File not found", "");
-    send(client_fd, &res, sizeof(res), 0);
+    send_response(client_fd, &res);
 }
 
 // modify file permissions
 void change_mode(int client_fd, User client, const char* filename, const char* permissions) {
 
     for (int i = 0; i < file_num; i++) {
-        if (!strcmp(file_list[i].filename, filename)) { // found
+        if (!file_list[i].deleted && !strcmp(file_list[i].filename, filename)) { // found
             if (!strcmp(file_list[i].owner, client.name)) { // client is the owner
                 strcpy(file_list[i].permissions, permissions);
+                file_list[i].version++;
 
                 Response res;
                 format_result(&res, "Permissions changed", "");
-                send(client_fd, &res, sizeof(res), 0);
+                send_response(client_fd, &res);
                 log_add(client.name, "mode", filename, "permissions changed");
+                notify_watchers(i, "Watch event: file changed");
             } else {
                 Response res;
                 format_result(&res, "Permission denied", "");
-                send(client_fd, &res, sizeof(res), 0);
+                send_response(client_fd, &res);
                 log_add(client.name, "mode", filename, "permission denied");
             }
             return;
@@ -362,7 +1558,205 @@ void change_mode(int client_fd, User client, const char* filename, const char* p
 
     Response res;
     format_result(&res, "File not found", "");
-    send(client_fd, &res, sizeof(res), 0);
+    send_response(client_fd, &res);
+}
+
+// delete file, the data is unlinked later by the reclaimer
+void delete_file(int client_fd, User client, const char* filename) {
+
+    Response res;
+    int i = find_file(filename);
+    if (i < 0) {
+        format_result(&res, "File not found", "");
+        send_response(client_fd, &res);
+        return;
+    }
+
+    if (strcmp(file_list[i].owner, client.name)) {  // only the owner can delete
+        format_result(&res, "Permission denied", "");
+        send_response(client_fd, &res);
+        log_add(client.name, "delete", filename, "permission denied");
+        return;
+    }
+
+    if (file_list[i].isModified) {
+        format_result(&res, "File is modifying", "");
+        send_response(client_fd, &res);
+        return;
+    }
+    file_list[i].isModified = true;
+
+    // move the file into the trash, renaming is O(1) whatever the file size
+    struct stat st;
+    if (stat(TRASH_DIRECTORY, &st) == -1) 
+        mkdir(TRASH_DIRECTORY, 0700);
+
+    char filepath[512], trashpath[300];
+    snprintf(filepath, sizeof(filepath), "%s//%s", FILE_DIRECTORY, filename);
+    pthread_mutex_lock(&catalog_lock);
+    snprintf(trashpath, sizeof(trashpath), "%s/%ld-%ld", TRASH_DIRECTORY, (long)time(NULL), trash_seq++);
+    pthread_mutex_unlock(&catalog_lock);
+
+    if (rename(filepath, trashpath) < 0) {
+        perror("Failed to delete file");
+        file_list[i].isModified = false;
+        format_result(&res, "Failed to delete file", "");
+        send_response(client_fd, &res);
+        log_add(client.name, "delete", filename, "failed");
+        return;
+    }
+
+    map_invalidate(i);
+    quota_charge(file_list[i].owner, file_list[i].group, -file_list[i].size, -1);
+    file_list[i].version++;
+    notify_watchers(i, "Watch event: file deleted");
+    watch_clear(i);
+    catalog_free(i);
+    reclaim_enqueue(trashpath);
+
+    format_result(&res, "File deleted", "");
+    send_response(client_fd, &res);
+    log_add(client.name, "delete", filename, "success");
+}
+
+// rename file
+void rename_file(int client_fd, User client, const char* filename, const char* new_filename) {
+
+    Response res;
+    int i = find_file(filename);
+    if (i < 0) {
+        format_result(&res, "File not found", "");
+        send_response(client_fd, &res);
+        return;
+    }
+
+    if (strcmp(file_list[i].owner, client.name)) {  // only the owner can rename
+        format_result(&res, "Permission denied", "");
+        send_response(client_fd, &res);
+        log_add(client.name, "rename", filename, "permission denied");
+        return;
+    }
+
+    if (!correctFilenameFormat(new_filename)) {
+        format_result(&res, "Invalid command", "Filename cannot start with '.' or contain '/'.");
+        send_response(client_fd, &res);
+        return;
+    }
+
+    if (find_file(new_filename) >= 0) {
+        format_result(&res, "File already exists", "");
+        send_response(client_fd, &res);
+        return;
+    }
+
+    if (file_list[i].isModified) {
+        format_result(&res, "File is modifying", "");
+        send_response(client_fd, &res);
+        return;
+    }
+    file_list[i].isModified = true;
+
+    char filepath[512], new_filepath[512];
+    snprintf(filepath, sizeof(filepath), "%s//%s", FILE_DIRECTORY, filename);
+    snprintf(new_filepath, sizeof(new_filepath), "%s//%s", FILE_DIRECTORY, new_filename);
+
+    // link() fails if the target exists on disk, so nothing outside the catalog is overwritten
+    bool renamed = false;
+    if (link(filepath, new_filepath) == 0) {
+        if (unlink(filepath) == 0) renamed = true;
+        else unlink(new_filepath);  // roll back
+    }
+
+    if (!renamed) {
+        bool exists = errno == EEXIST;
+        perror("Failed to rename file");
+        file_list[i].isModified = false;
+        format_result(&res, exists ? "File already exists" : "Failed to rename file", "");
+        send_response(client_fd, &res);
+        log_add(client.name, "rename", filename, "failed");
+        return;
+    }
+
+    // the slot and its mapping stay the same, only the name changes
+    strcpy(file_list[i].filename, new_filename);
+    file_list[i].version++;
+    file_list[i].isModified = false;
+
+    format_result(&res, "File renamed", "");
+    send_response(client_fd, &res);
+    log_add(client.name, "rename", filename, "success");
+    notify_watchers(i, "Watch event: file renamed");
+}
+
+// truncate (or extend) file to the given size
+void truncate_file(int client_fd, User client, const char* filename, off_t size) {
+
+    Response res;
+    int i = find_file(filename);
+    if (i < 0) {
+        format_result(&res, "File not found", "");
+        send_response(client_fd, &res);
+        return;
+    }
+
+    if (!(  // Open to everyone to write
+            (file_list[i].permissions[5] == 'w') ||  
+            // The group the client belongs to has write permissions
+            (!strcmp(file_list[i].group, client.group) && file_list[i].permissions[3] == 'w') ||
+            // client is the owner
+            (!strcmp(file_list[i].owner, client.name)) )) {
+        format_result(&res, "Permission denied", "");
+        send_response(client_fd, &res);
+        log_add(client.name, "truncate", filename, "permission denied");
+        return;
+    }
+
+    if (file_list[i].isModified) {
+        format_result(&res, "File is modifying", "");
+        send_response(client_fd, &res);
+        return;
+    }
+    if (!quota_charge(file_list[i].owner, file_list[i].group, size - file_list[i].size, 0)) {
+        format_result(&res, "Byte quota exceeded", "");
+        send_response(client_fd, &res);
+        log_add(client.name, "truncate", filename, "quota exceeded");
+        return;
+    }
+    file_list[i].isModified = true;
+
+    // readers of the old mapping must be gone before the file shrinks
+    map_drain(i);
+
+    char filepath[512];
+    snprintf(filepath, sizeof(filepath), "%s//%s", FILE_DIRECTORY, filename);
+
+    if (truncate(filepath, size) < 0) {
+        perror("Failed to truncate file");
+        quota_charge(file_list[i].owner, file_list[i].group, file_list[i].size - size, 0);
+        file_list[i].isModified = false;
+        format_result(&res, "Failed to truncate file", "");
+        send_response(client_fd, &res);
+        log_add(client.name, "truncate", filename, "failed");
+        return;
+    }
+
+    map_invalidate(i);  // a reader may have mapped the old length after map_drain
+    file_list[i].size = size;
+    file_checksum(filepath, &file_list[i].checksum);
+    file_list[i].checked_at = time(NULL);
+    file_list[i].corrupted = false;
+
+    // update last modified time
+    time_t now = time(NULL);
+    struct tm* tm_info = localtime(&now);
+    strftime(file_list[i].last_modified, sizeof(file_list[i].last_modified), "%Y/%m/%d %H:%M", tm_info);
+    file_list[i].version++;
+    file_list[i].isModified = false;
+
+    format_result(&res, "File truncated", "");
+    send_response(client_fd, &res);
+    log_add(client.name, "truncate", filename, "success");
+    notify_watchers(i, "Watch event: file changed");
 }
 
 // get file name fault tolerance
@@ -379,7 +1773,7 @@ char* getFilename(char* command){
 // handle client requests
 void *client_handler(void *client_socket) {
     
-    int client_fd = *(int *)client_socket;
+    int client_fd = (int)(intptr_t)client_socket;
     ClientRequest request;
 
     int read_size;
@@ -387,31 +1781,54 @@ void *client_handler(void *client_socket) {
     // receive client request
     while ((read_size = recv(client_fd, &request, sizeof(ClientRequest), 0)) > 0) {
 
+        // shutting down --> do not start new requests
+        pthread_mutex_lock(&conn_lock);
+        bool stop = !server_running;
+        connections[client_fd].busy = !stop;
+        pthread_mutex_unlock(&conn_lock);
+        if (stop) break;
+
         User client     = request.user;
         char* command   = request.command;
 
-        char filename[256], permissions[6], write_mode[2];
+        char filename[256], new_filename[256], permissions[6], write_mode[2], option[7];
+        long long size;
+
+        atomic_store(&last_request_ms, now_ms());
 
         // Commands from the client side
-        if(!strlen(command)) {
+        if (!rate_allow(client)) {
+            Response res;
+            format_result(&res, "Rate limit exceeded", "Too many requests, please retry later.");
+            send_response(client_fd, &res);
+        }
+        else if(!strlen(command)) {
             Response res;
             format_result(&res, "...", "");
-            send(client_fd, &res, sizeof(res), 0);
+            send_response(client_fd, &res);
         }
         else if (!strcmp(command, "ls")) {
             list_file(client_fd, client);
         }
         else if (sscanf(command, "create  %s %s", filename, permissions) == 2) {
-            if(correctPermissionFormat(permissions))
+            if (!correctFilenameFormat(filename)) {
+                Response res;
+                format_result(&res, "Invalid command", "Filename cannot start with '.' or contain '/'.");
+                send_response(client_fd, &res);
+            }
+            else if(correctPermissionFormat(permissions))
                 create_file(client_fd, client, getFilename(command), permissions); 
             else {
                 Response res;
                 format_result(&res, "Invalid command", "Permission format incorrect.(ex: rwrw--)");
-                send(client_fd, &res, sizeof(res), 0);
+                send_response(client_fd, &res);
             }
         }
+        else if (sscanf(command, "read %255s %6s", filename, option) == 2 && !strcmp(option, "verify")) {
+            read_file(client_fd, client, filename, true);
+        }
         else if (sscanf(command, "read %s", filename) == 1) {
-            read_file(client_fd, client, filename);
+            read_file(client_fd, client, filename, false);
         }
         else if (sscanf(command, "write %s %s", filename, write_mode) == 2) {
             write_file(client_fd, client, getFilename(command), write_mode);
@@ -422,67 +1839,586 @@ void *client_handler(void *client_socket) {
             else {
                 Response res;
                 format_result(&res, "Invalid command", "Permission format incorrect.(ex: rwrw--)");
-                send(client_fd, &res, sizeof(res), 0);
+                send_response(client_fd, &res);
             }
         }
+        else if (sscanf(command, "delete %255s", filename) == 1) {
+            delete_file(client_fd, client, filename);
+        }
+        else if (sscanf(command, "rename %255s %255s", filename, new_filename) == 2) {
+            rename_file(client_fd, client, filename, new_filename);
+        }
+        else if (sscanf(command, "truncate %255s %lld", filename, &size) == 2 && size >= 0) {
+            truncate_file(client_fd, client, filename, size);
+        }
+        else if (sscanf(command, "watch %255s", filename) == 1) {
+            watch_file(client_fd, client, filename);
+        }
+        else if (sscanf(command, "unwatch %255s", filename) == 1) {
+            unwatch_file(client_fd, client, filename);
+        }
         else {
             Response res;
             format_result(&res, "Invalid command", "Type \"help\" to view all the valid command.");
-            send(client_fd, &res, sizeof(res), 0);
+            send_response(client_fd, &res);
         }
+
+        // request done, quit here if the server is shutting down
+        pthread_mutex_lock(&conn_lock);
+        connections[client_fd].busy = false;
+        stop = !server_running;
+        pthread_mutex_unlock(&conn_lock);
+        if (stop) break;
     }
 
+    watch_drop_connection(client_fd);
+
+    // close under the send lock, a pusher holding an old watch entry sees the new generation
+    pthread_mutex_lock(&send_locks[client_fd]);
+    pthread_mutex_lock(&conn_lock);
+    connections[client_fd].generation++;
+    pthread_mutex_unlock(&conn_lock);
     close(client_fd);
+    pthread_mutex_unlock(&send_locks[client_fd]);
+
+    pthread_mutex_lock(&conn_lock);
+    connections[client_fd].open = false;
+    client_count--;
+    pthread_cond_broadcast(&conn_cond);
+    pthread_mutex_unlock(&conn_lock);
+    return NULL;
+}
+
+// microseconds since start
+double elapsed_us(struct timespec start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) * 1e6 + (now.tv_nsec - start.tv_nsec) / 1e3;
+}
+
+// compare the stdio and mmap read paths on files of different sizes
+void bench_read_paths() {
+    const size_t sizes[] = {4 * 1024, 64 * 1024, 1024 * 1024, 16 * 1024 * 1024};
+    char filepath[512];
+    snprintf(filepath, sizeof(filepath), "%s//.bench", FILE_DIRECTORY);
+
+    struct stat st;
+    if (stat(FILE_DIRECTORY, &st) == -1) 
+        mkdir(FILE_DIRECTORY, 0700);
+
+    printf("Size\t\tstdio (us/read)\tmmap (us/read)\tfirst map (us)\n");
+    printf("=================================================================================\n");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        // build the test file
+        FILE *file = fopen(filepath, "w");
+        if (file == NULL) {
+            perror("Failed to create benchmark file");
+            return;
+        }
+        for (size_t n = 0; n < sizes[s]; n++) fputc('a' + n % 26, file);
+        fclose(file);
+
+        Response res;
+        struct timespec start;
+
+        // stdio path: what read_file does for small files
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int r = 0; r < BENCH_ROUNDS; r++) {
+            file = fopen(filepath, "r");
+            if (file == NULL) {
+                perror("Failed to open benchmark file");
+                unlink(filepath);
+                return;
+            }
+            size_t read_size = fread(res.content, 1, CONTENT_SIZE - 1, file);
+            res.content[read_size] = '\0';
+            fclose(file);
+        }
+        double stdio_us = elapsed_us(start) / BENCH_ROUNDS;
+
+        // mmap path: first request creates the mapping, later ones reuse it
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        MappedFile *map = map_acquire(BENCH_MAP_SLOT, filepath);
+        if (map == NULL) {
+            printf("failed to map the benchmark file.\n\n");
+            unlink(filepath);
+            return;
+        }
+        format_from_map(&res, "File read successful", map);
+        map_release(map);
+        double first_us = elapsed_us(start);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int r = 0; r < BENCH_ROUNDS; r++) {
+            map = map_acquire(BENCH_MAP_SLOT, filepath);
+            if (map == NULL) break;
+            format_from_map(&res, "File read successful", map);
+            map_release(map);
+        }
+        double mmap_us = elapsed_us(start) / BENCH_ROUNDS;
+        map_invalidate(BENCH_MAP_SLOT);
+        if (map == NULL) {
+            printf("failed to map the benchmark file.\n\n");
+            unlink(filepath);
+            return;
+        }
+
+        printf("%-8zu\t%.2f\t\t%.2f\t\t%.2f\n", sizes[s], stdio_us, mmap_us, first_us);
+    }
+
+    unlink(filepath);
+    printf("\n");
+}
+
+// cost of the checks done on every request and write
+void bench_quota() {
+    Usage usage;
+    memset(&usage, 0, sizeof(usage));
+    atomic_store(&usage.rate, MAX_RATE_LIMIT);
+    atomic_store(&usage.byte_quota, 1LL << 40);
+    bucket_reset(&usage);
+
+    struct timespec start;
+    const int rounds = BENCH_ROUNDS * 100;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < rounds; r++) bucket_take(&usage);
+    double bucket_ns = elapsed_us(start) * 1000 / rounds;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < rounds; r++) {
+        counter_reserve(&usage.bytes_used, atomic_load(&usage.byte_quota), 4096);
+        counter_reserve(&usage.bytes_used, atomic_load(&usage.byte_quota), -4096);
+    }
+    double counter_ns = elapsed_us(start) * 1000 / rounds / 2;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < rounds; r++) usage_find("(bench)", false, false);
+    double lookup_ns = elapsed_us(start) * 1000 / rounds;
+
+    printf("Quota check\t\tns/op\n");
+    printf("=================================================================================\n");
+    printf("token bucket\t\t%.1f\n", bucket_ns);
+    printf("usage counter\t\t%.1f\n", counter_ns);
+    printf("identity lookup (miss)\t%.1f\n\n", lookup_ns);
+}
+
+// re-check the checksums of cold files in the background, only while the server is idle
+void *scrubber_handler() {
+    unsigned char *buffer = malloc(SCRUB_CHUNK);
+    if (buffer == NULL) return NULL;
+
+    while (server_running) {
+        sleep(1);
+
+        for (int i = 0; i < file_num && server_running; i++) {
+            if (file_list[i].deleted || file_list[i].isModified || 
+                time(NULL) - file_list[i].checked_at < SCRUB_INTERVAL) continue;
+
+            unsigned long version = file_list[i].version;
+            uint32_t stored = file_list[i].checksum;
+
+            char filepath[512];
+            snprintf(filepath, sizeof(filepath), "%s//%s", FILE_DIRECTORY, file_list[i].filename);
+            int fd = open(filepath, O_RDONLY);
+            if (fd < 0) continue;
+
+            uint32_t crc = 0;
+            ssize_t read_size;
+            while ((read_size = read(fd, buffer, SCRUB_CHUNK)) > 0) {
+                crc = crc32c_update(crc, buffer, read_size);
+
+                // at most SCRUB_CHUNK bytes per SCRUB_PAUSE_MS, and back off while clients are active
+                usleep(SCRUB_PAUSE_MS * 1000);
+                while (server_running && now_ms() - atomic_load(&last_request_ms) < SCRUB_IDLE_MS) 
+                    usleep(SCRUB_IDLE_MS * 1000);
+            }
+            close(fd);
+
+            // a write landed meanwhile --> the result means nothing, try again later
+            if (read_size < 0 || file_list[i].deleted || file_list[i].isModified || file_list[i].version != version) 
+                continue;
+
+            file_list[i].checked_at = time(NULL);
+            if (crc != stored) {
+                if (!file_list[i].corrupted) report_mismatch(i, crc);
+            }
+            else file_list[i].corrupted = false;
+        }
+    }
+
+    free(buffer);
     return NULL;
 }
 
+// show the checksum state of every file
+void verify_list() {
+    printf("Name                Checksum    Last checked        Status\n");
+    printf("=================================================================================\n");
+
+    for (int i = 0; i < file_num; i++) {
+        if (file_list[i].deleted) continue;
+
+        char checked[20];
+        time_t checked_at = file_list[i].checked_at;
+        strftime(checked, sizeof(checked), "%Y/%m/%d %H:%M", localtime(&checked_at));
+        printf("%-17s   %08x    %s    %s\n", file_list[i].filename, file_list[i].checksum, checked, 
+            file_list[i].corrupted ? "CHECKSUM MISMATCH" : "ok");
+    }
+    printf("\n");
+}
+
+// verify one file right now
+void verify_now(const char *filename) {
+    int i = find_file(filename);
+    if (i < 0) {
+        printf("File not found.\n\n");
+        return;
+    }
+
+    if (file_list[i].isModified) {
+        printf("%s is being modified, try again later.\n\n", filename);
+        return;
+    }
+    unsigned long version = file_list[i].version;
+    uint32_t stored = file_list[i].checksum;
+
+    char filepath[512];
+    uint32_t crc;
+    snprintf(filepath, sizeof(filepath), "%s//%s", FILE_DIRECTORY, filename);
+    if (!file_checksum(filepath, &crc)) {
+        printf("failed to read the file.\n\n");
+        return;
+    }
+
+    // same rule as the scrubber: a change meanwhile makes the result meaningless
+    if (file_list[i].deleted || file_list[i].isModified || file_list[i].version != version) {
+        printf("%s changed during verification, try again.\n\n", filename);
+        return;
+    }
+
+    file_list[i].checked_at = time(NULL);
+    if (crc != stored) report_mismatch(i, crc);
+    else {
+        file_list[i].corrupted = false;
+        printf("%s: checksum %08x ok\n", filename, crc);
+    }
+    printf("\n");
+}
+
+// stop accepting connections, wake the accept loop in main
+void server_stop() {
+    server_running = 0;
+    if (write(wakeup_pipe[1], "x", 1) < 0) perror("Failed to wake the server");
+}
+
+// SIGTERM: shut down like the "exit" command (only async-signal-safe calls)
+void stop_handler(int sig) {
+    (void)sig;
+    server_running = 0;
+    if (write(wakeup_pipe[1], "x", 1) < 0) return;
+}
+
+// close idle connections, give busy ones until the deadline to finish their request
+void drain_clients() {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += SHUTDOWN_DEADLINE;
+
+    pthread_mutex_lock(&conn_lock);
+    printf("Draining %d connections...\n", client_count);
+
+    // idle clients are waiting in recv(), end their stream
+    for (int fd = 0; fd < MAX_FD; fd++) 
+        if (connections[fd].open && !connections[fd].busy) shutdown(fd, SHUT_RD);
+
+    // busy clients quit after their current request
+    while (client_count > 0) {
+        if (pthread_cond_timedwait(&conn_cond, &conn_lock, &deadline) == ETIMEDOUT) {
+            printf("%d connections did not finish in time, closing them.\n", client_count);
+            for (int fd = 0; fd < MAX_FD; fd++) 
+                if (connections[fd].open) shutdown(fd, SHUT_RDWR);
+
+            // give the threads a moment to notice
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += 1;
+            while (client_count > 0 && pthread_cond_timedwait(&conn_cond, &conn_lock, &deadline) != ETIMEDOUT);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&conn_lock);
+}
+
+// count files loaded from the catalog, without checking the quota
+void quota_restore(const char *owner, const char *group, long long bytes) {
+    Usage *user = usage_find(owner, false, true);
+    Usage *team = usage_find(group, true, true);
+    if (user != NULL) {
+        atomic_fetch_add(&user->bytes_used, bytes);
+        atomic_fetch_add(&user->files_used, 1);
+    }
+    if (team != NULL) {
+        atomic_fetch_add(&team->bytes_used, bytes);
+        atomic_fetch_add(&team->files_used, 1);
+    }
+}
+
+// save the live catalog entries for the next server process
+void catalog_save() {
+    char tmppath[64];
+    snprintf(tmppath, sizeof(tmppath), "%s.tmp", CATALOG_FILE);
+
+    FILE *file = fopen(tmppath, "wb");
+    if (file == NULL) {
+        perror("Failed to save the catalog");
+        return;
+    }
+
+    // entry size first, a new binary with a different Capability layout starts empty
+    size_t entry_size = sizeof(Capability);
+    fwrite(&entry_size, sizeof(entry_size), 1, file);
+    for (int i = 0; i < file_num; i++) {
+        if (file_list[i].deleted) continue;
+
+        Capability entry = file_list[i];
+        entry.isModified = false;
+        fwrite(&entry, sizeof(entry), 1, file);
+    }
+
+    fflush(file);
+    fsync(fileno(file));
+    fclose(file);
+    if (rename(tmppath, CATALOG_FILE) < 0) perror("Failed to save the catalog");
+}
+
+// load the catalog saved by the previous server process
+void catalog_load() {
+    FILE *file = fopen(CATALOG_FILE, "rb");
+    if (file == NULL) return;
+
+    size_t entry_size;
+    if (fread(&entry_size, sizeof(entry_size), 1, file) != 1 || entry_size != sizeof(Capability)) {
+        printf("Catalog format changed, starting with an empty file list.\n");
+        fclose(file);
+        return;
+    }
+
+    while (file_num < MAX_FILES_NUM && fread(&file_list[file_num], sizeof(Capability), 1, file) == 1) {
+        Capability *entry = &file_list[file_num];
+        entry->isModified = false;
+        entry->deleted = false;
+        quota_restore(entry->owner, entry->group, entry->size);
+        file_num++;
+    }
+    fclose(file);
+}
+
+// flush and close the active log segment
+void log_close() {
+    pthread_mutex_lock(&log_lock);
+    if (log_fd >= 0) {
+        fsync(log_fd);
+        close(log_fd);
+        log_fd = -1;
+    }
+    pthread_mutex_unlock(&log_lock);
+}
+
+// address of the hot restart socket
+void handoff_address(struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    strncpy(addr->sun_path, HANDOFF_SOCKET, sizeof(addr->sun_path) - 1);
+}
+
+// hot restart: start the new server and wait until it connects to the handoff socket (-1 on failure)
+int handoff_start() {
+    struct sockaddr_un addr;
+    handoff_address(&addr);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        perror("Handoff socket creation failed");
+        return -1;
+    }
+    fcntl(listen_fd, F_SETFD, FD_CLOEXEC);
+
+    unlink(HANDOFF_SOCKET);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, 1) < 0) {
+        perror("Handoff socket failed");
+        close(listen_fd);
+        return -1;
+    }
+
+    pid_t handoff_pid = fork();
+    if (handoff_pid == 0) {     // new server
+        execl(server_path, server_path, "--takeover", (char *)NULL);
+        perror("Failed to start the new server");
+        _exit(EXIT_FAILURE);
+    }
+
+    int conn_fd = -1;
+    struct pollfd pfd = {listen_fd, POLLIN, 0};
+    if (handoff_pid > 0 && poll(&pfd, 1, HANDOFF_TIMEOUT * 1000) > 0) 
+        conn_fd = accept(listen_fd, NULL, NULL);
+
+    close(listen_fd);
+    unlink(HANDOFF_SOCKET);
+
+    if (conn_fd < 0 && handoff_pid > 0) {   // the new server never showed up
+        kill(handoff_pid, SIGTERM);
+        waitpid(handoff_pid, NULL, 0);
+        handoff_pid = -1;
+    }
+    return conn_fd;
+}
+
+// pass the listening socket to the new server
+bool send_listener(int conn_fd, int listen_fd) {
+    char byte = 0;
+    struct iovec iov = {&byte, 1};
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &listen_fd, sizeof(int));
+
+    return sendmsg(conn_fd, &msg, 0) == 1;
+}
+
+// new server: get the listening socket from the old one (-1 on failure)
+int receive_listener() {
+    struct sockaddr_un addr;
+    handoff_address(&addr);
+
+    int conn_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (conn_fd < 0) return -1;
+
+    // the old server may still be setting up the socket
+    int tries = 0;
+    while (connect(conn_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        if (++tries == HANDOFF_TIMEOUT * 10) {
+            close(conn_fd);
+            return -1;
+        }
+        usleep(100 * 1000);
+    }
+
+    // blocks until the old server has drained its clients
+    char byte;
+    struct iovec iov = {&byte, 1};
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    int listen_fd = -1;
+    if (recvmsg(conn_fd, &msg, 0) == 1) {
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) 
+            memcpy(&listen_fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+    close(conn_fd);
+    return listen_fd;
+}
+
 // Server management commands
 void *admin_handler() {
     char command[256];
 
+    // only cancelled while waiting for input (SIGTERM), never while holding a lock
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
     while (server_running) {
         printf("admin> ");
         fflush(stdout);
-        fgets(command, sizeof(command), stdin);
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        char *line = fgets(command, sizeof(command), stdin);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        if (line == NULL) {
+            // stdin closed, or the shell took the terminal back after a hot restart
+            printf("\nAdmin console closed, the server keeps running (stop it with SIGTERM).\n");
+            fflush(stdout);
+            return NULL;
+        }
         command[strcspn(command, "\n")] = '\0';  // Remove newline characters
 
         // server-side instructions
         if (!strcmp(command, "exit")) {     // exit
             printf("Shutting down server...\n");
-
-            // establish a placeholder connection and break accept()
-            int temp_fd = socket(AF_INET, SOCK_STREAM, 0);
-            struct sockaddr_in temp_addr;
-            temp_addr.sin_family = AF_INET;
-            temp_addr.sin_port = htons(PORT);
-            inet_pton(AF_INET, SERVER_ADDR, &temp_addr.sin_addr);
-            connect(temp_fd, (struct sockaddr *)&temp_addr, sizeof(temp_addr));
-            close(temp_fd);
-
-            server_running = 0;  
+            server_stop();
             return NULL;
         }
-        else if (!strcmp(command, "log")) {  // show the log file
-            char buffer[CONTENT_SIZE];
-            size_t numread;
-
-            FILE *log = fopen("socket.log", "r");
-            if (log == NULL) {
-                printf("failed to open the file.\n\n");
+        else if (!strcmp(command, "restart")) {     // hot restart, the new server takes over the listening socket
+            printf("Starting the new server...\n");
+            handoff_fd = handoff_start();
+            if (handoff_fd < 0) {
+                printf("Hot restart failed, the server keeps running.\n\n");
+                continue;
+            }
+            printf("New server is waiting for the listening socket.\n");
+            server_stop();
+            return NULL;
+        }
+        else if (!strcmp(command, "log") || !strncmp(command, "log ", 4)) {  // show the latest log records
+            int n = LOG_TAIL_DEFAULT;
+            if (strlen(command) > 4 && (sscanf(command + 4, "%d", &n) != 1 || n <= 0)) {
+                printf("Usage: log [number of records]\n\n");
+                continue;
+            }
+            printf("=================================================================================\n");
+            log_tail(n);
+            printf("\n");
+        }
+        else if (!strncmp(command, "query ", 6)) {   // search the log
+            LogQuery query;
+            if (!parse_log_query(command + 6, &query)) {
+                printf("Usage: query [user=] [file=] [action=] [status=] [from=YYYY/MM/DD-HH:MM] [to=YYYY/MM/DD-HH:MM]\n\n");
                 continue;
             }
-            numread = fread(buffer, sizeof(char), CONTENT_SIZE, log);
-            printf("read %lu bytes\n", numread);
             printf("=================================================================================\n");
-            printf("%s\n", buffer);
-            fclose(log);
+            int matched = log_query(&query, stdout);
+            printf("%d records matched\n\n", matched);
+        }
+        else if (!strcmp(command, "export") || !strncmp(command, "export ", 7)) {   // plain-text copy of the log
+            const char *path = strlen(command) > 7 ? command + 7 : "socket.log";
+            FILE *out = fopen(path, "w");
+            if (out == NULL) {
+                printf("failed to open the file.\n\n");
+                continue;
+            }
+            LogQuery query = { NULL, NULL, NULL, NULL, INT64_MIN, INT64_MAX };
+            int matched = log_query(&query, out);
+            fclose(out);
+            printf("exported %d records to %s\n\n", matched, path);
         }
         else if (!strcmp(command, "list")) { // show the file list
             printf("Permission\tName                Owner        Group\tsize\tLast modified\n");
             printf("=================================================================================\n");
             
             for(int i = 0; i < file_num; i++)
-                printf("%s\t\t%-17s   %-10s   %s\t%ld\t%s\n", 
+                if (!file_list[i].deleted) printf("%s\t\t%-17s   %-10s   %s\t%ld\t%s\n", 
                     file_list[i].permissions, 
                     file_list[i].filename, 
                     file_list[i].owner, 
@@ -492,12 +2428,38 @@ void *admin_handler() {
                 );
             printf("\n");
         }
+        else if (!strcmp(command, "bench")) { // compare the read paths, measure quota enforcement
+            bench_read_paths();
+            bench_quota();
+        }
+        else if (!strcmp(command, "verify")) {  // show the checksum state
+            verify_list();
+        }
+        else if (!strncmp(command, "verify ", 7)) { // verify one file now
+            verify_now(command + 7);
+        }
+        else if (!strcmp(command, "quota")) {   // show usage and limits
+            quota_list();
+        }
+        else if (!strncmp(command, "quota ", 6)) {  // adjust limits
+            if (quota_apply(command + 6)) printf("Quota updated.\n\n");
+            else printf("Usage: quota user|group <name|*> [bytes=N] [files=N] [rate=N] (0 means unlimited)\n\n");
+        }
         else if (!strcmp(command, "help")) { // list the commands on server
             printf("\nThere're the commands on the server:\n");
             printf("================================================\n");
-            printf(" exit:\tclose the server.\n");
-            printf(" log:\tlist all the actions in log file.\n");
+            printf(" exit:\tclose the server after the running requests finish.\n");
+            printf(" restart:\tstart a new server process and hand it the listening socket.\n");
+            printf(" log [n]:\tlist the latest n actions in the log (default %d).\n", LOG_TAIL_DEFAULT);
+            printf(" query [user=] [file=] [action=] [status=] [from=] [to=]:\n");
+            printf("\tsearch the log, times as YYYY/MM/DD-HH:MM, '_' in status= stands for a space.\n");
+            printf(" export [path]:\twrite the log as plain text (default socket.log).\n");
             printf(" list:\tlist all the files on the server.\n");
+            printf(" bench:\tcompare the stdio and mmap read paths, measure quota checks.\n");
+            printf(" verify [name]:\tshow the checksum state of the files, or verify one file now.\n");
+            printf(" quota:\tshow the usage and limits of users and groups.\n");
+            printf(" quota user|group <name|*> [bytes=N] [files=N] [rate=N]:\n");
+            printf("\tchange limits (0 means unlimited, * sets the defaults).\n");
             printf("================================================\n\n");
         }
         else if (strlen(command))
@@ -507,46 +2469,108 @@ void *admin_handler() {
     return NULL;
 }
 
-int main(){
+int main(int argc, char *argv[]){
 
     int server_fd, client_fd;
     struct sockaddr_in server_addr, client_addr;
     
     socklen_t client_num = sizeof(client_addr); // number of clients
     pthread_t thread_id, admin_thread;
+    server_path = argv[0];
+
+    // hot restart: the old server hands over its listening socket, connections keep queuing meanwhile
+    if (argc > 1 && !strcmp(argv[1], "--takeover")) {
+        server_fd = receive_listener();
+        if (server_fd < 0) {
+            printf("Failed to take over the listening socket.\n");
+            exit(EXIT_FAILURE);
+        }
+        listen(server_fd, LISTEN_BACKLOG);  // a listener from an older server may queue fewer connections
+        printf("Took over the listening socket.\n");
+    }
+    else {
+        // Create server socket
+        server_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (server_fd < 0) {
+            perror("Socket creation failed");
+            exit(EXIT_FAILURE);
+        }
 
-    // Create server socket
-    server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd < 0) {
-        perror("Socket creation failed");
-        exit(EXIT_FAILURE);
+        // a restarted server can bind while old connections are in TIME_WAIT
+        int reuse = 1;
+        setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        // setting server_addr
+        server_addr.sin_family = AF_INET;
+        server_addr.sin_port = htons(PORT);
+        if (inet_pton(AF_INET, SERVER_ADDR, &server_addr.sin_addr) <= 0) {
+            perror("Invalid address or Address not supported");
+            exit(EXIT_FAILURE);
+        }
+
+        // Connect socket to server_addr
+        if (bind(server_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+            perror("Bind failed");
+            close(server_fd);
+            exit(EXIT_FAILURE);
+        }
+
+        // monitor connection
+        if (listen(server_fd, LISTEN_BACKLOG) < 0) {
+            perror("Listen failed");
+            close(server_fd);
+            exit(EXIT_FAILURE);
+        }
     }
+    fcntl(server_fd, F_SETFD, FD_CLOEXEC);  // only passed on through the handoff socket
 
-    // setting server_addr
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(PORT);
-    if (inet_pton(AF_INET, SERVER_ADDR, &server_addr.sin_addr) <= 0) {
-        perror("Invalid address or Address not supported");
+    // wakes the accept loop on shutdown
+    if (pipe(wakeup_pipe) < 0) {
+        perror("Pipe creation failed");
+        close(server_fd);
         exit(EXIT_FAILURE);
     }
+    fcntl(wakeup_pipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(wakeup_pipe[1], F_SETFD, FD_CLOEXEC);
 
-    // Connect socket to server_addr
-    if (bind(server_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        perror("Bind failed");
+    // graceful shutdown without the admin console, a server in the background keeps running instead of stopping
+    signal(SIGTERM, stop_handler);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+
+    printf("Server started on port %d\n", PORT);
+    printf("Input \"help\" to list the command in server.\n\n");
+
+    // continue the audit log from its last segment
+    pthread_mutex_lock(&log_lock);
+    log_open_segment();
+    pthread_mutex_unlock(&log_lock);
+
+    // quota settings, then the files of the previous run
+    quota_load();
+    catalog_load();
+
+    for (int fd = 0; fd < MAX_FD; fd++) 
+        pthread_mutex_init(&send_locks[fd], NULL);
+
+    // Start the thread that re-verifies checksums
+    pthread_t scrubber_thread;
+    crc32c_init();
+    if (pthread_create(&scrubber_thread, NULL, scrubber_handler, NULL) != 0) {
+        perror("Scrubber thread creation failed");
         close(server_fd);
         exit(EXIT_FAILURE);
     }
 
-    // monitor connection
-    if (listen(server_fd, MAX_CLIENTS) < 0) {
-        perror("Listen failed");
+    // Start the thread that unlinks deleted files
+    pthread_t reclaimer_thread;
+    reclaim_leftovers();
+    if (pthread_create(&reclaimer_thread, NULL, reclaimer_handler, NULL) != 0) {
+        perror("Reclaimer thread creation failed");
         close(server_fd);
         exit(EXIT_FAILURE);
     }
 
-    printf("Server started on port %d\n", PORT);
-    printf("Input \"help\" to list the command in server.\n\n");
-
     // Start the thread for management instructions
     if (pthread_create(&admin_thread, NULL, admin_handler, NULL) != 0) {
         perror("Admin thread creation failed");
@@ -555,12 +2579,32 @@ int main(){
     }
 
     while (server_running) {
+
+        // wait for a client or the shutdown signal
+        struct pollfd fds[2] = {{server_fd, POLLIN, 0}, {wakeup_pipe[0], POLLIN, 0}};
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("Poll error");
+            break;
+        }
+        if (fds[1].revents) break;
         
         // client connection
         client_fd = accept(server_fd, (struct sockaddr *)&client_addr, &client_num);
 
         // accept client connection
         if (client_fd >= 0) {
+            fcntl(client_fd, F_SETFD, FD_CLOEXEC);
+
+            // no slot for the connection state
+            if (client_fd >= MAX_FD) {
+                Response res;
+                format_result(&res, "Server is busy", "Too many connections, please retry later.");
+                send(client_fd, &res, sizeof(res), MSG_NOSIGNAL);
+                close(client_fd);
+                continue;
+            }
+
             char client_ip[INET_ADDRSTRLEN];
             inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
 
@@ -570,11 +2614,19 @@ int main(){
                 fflush(stdout);
             }
 
-            if (pthread_create(&thread_id, NULL, client_handler, (void *)&client_fd) < 0) {
+            pthread_mutex_lock(&conn_lock);
+            connections[client_fd].open = true;
+            connections[client_fd].busy = false;
+            client_count++;
+            pthread_mutex_unlock(&conn_lock);
+
+            // pass the socket by value, client_fd is reused by the next accept()
+            if (pthread_create(&thread_id, NULL, client_handler, (void *)(intptr_t)client_fd) != 0) {
                 perror("Thread creation failed");
                 close(server_fd);
                 exit(EXIT_FAILURE);
             } 
+            pthread_detach(thread_id);
         }
         else{
             perror("Accept error");
@@ -582,9 +2634,26 @@ int main(){
         }
     }
 
-    // Wait for the managed thread to end
+    // Wait for the managed thread to end (still waiting for input after SIGTERM)
+    pthread_cancel(admin_thread);
     pthread_join(admin_thread, NULL);
 
+    // let the running requests finish, then flush the log and the file list
+    drain_clients();
+    pthread_join(scrubber_thread, NULL);
+    catalog_save();
+    log_close();
+
+    // hot restart: hand the listening socket over and exit, the new server inherited stdin and stdout
+    if (handoff_fd >= 0) {
+        if (send_listener(handoff_fd, server_fd)) printf("Listening socket handed over to the new server.\n\n");
+        else perror("Failed to hand over the listening socket");
+        fflush(stdout);
+        close(handoff_fd);
+        close(server_fd);
+        return 0;
+    }
+
     // close server socket
     close(server_fd);
     printf("Server shut down.\n");